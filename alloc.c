@@ -0,0 +1,39 @@
+#include "alloc.h"
+
+// bytes held by every kind and all kinds, and their peaks. Threads allocate
+// their workspaces concurrently, so counters are updated atomically
+static long held[ALLOC_KINDS], peaks[ALLOC_KINDS];
+static long heldTotal, peakTotal;
+
+// raising a peak to bytes if it is below
+static void raisePeak(long *peak, long bytes)
+{
+    long old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (old < bytes && !__atomic_compare_exchange_n(peak, &old, bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// bytes of a kind allocated
+void countAlloc(int kind, long bytes)
+{
+    raisePeak(&peaks[kind], __atomic_add_fetch(&held[kind], bytes, __ATOMIC_RELAXED));
+    raisePeak(&peakTotal, __atomic_add_fetch(&heldTotal, bytes, __ATOMIC_RELAXED));
+}
+
+// bytes of a kind released
+void countFree(int kind, long bytes)
+{
+    __atomic_sub_fetch(&held[kind], bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&heldTotal, bytes, __ATOMIC_RELAXED);
+}
+
+// most bytes held by every kind (ALLOC_KINDS of them) and by all kinds at once
+void allocPeaks(long *kindPeaks, long *totalPeak)
+{
+    int kind;
+
+    for (kind = 0; kind < ALLOC_KINDS; kind++)
+        kindPeaks[kind] = __atomic_load_n(&peaks[kind], __ATOMIC_RELAXED);
+    *totalPeak = __atomic_load_n(&peakTotal, __ATOMIC_RELAXED);
+}
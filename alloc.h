@@ -0,0 +1,26 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+// bookkeeping of the buffers of a run: every allocation and release of a
+// point, octree or filter buffer is counted where it happens, by kind of
+// buffer, with the most bytes each kind and all of them have held at once.
+// Mapped files and shared windows are counted like allocations, small staging
+// buffers of readers and collectives aren't counted
+
+enum AllocKind {
+    ALLOC_POINTS,       // point buffers of clouds, mapped or shared points
+    ALLOC_ATTRIBUTES,   // attribute records of the points
+    ALLOC_SUCCESSORS,   // successors of octrees, source order of an index
+    ALLOC_OCTANTS,
+    ALLOC_WORKSPACES,   // neighbor and distance lists of the querying threads
+    ALLOC_RESULTS,      // keep-masks, kept indexes and SOR mean distances
+    ALLOC_OUTPUT,       // buffers of the writers
+    ALLOC_DEDUP,        // unique points, weights and numbering of merged copies
+    ALLOC_KINDS
+};
+
+void countAlloc(int, long);
+void countFree(int, long);
+void allocPeaks(long *, long *);
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "batch.h"
+#include "pack.h"
+#include "mask.h"
+#include "trace.h"
+
+#define BATCH_SMALL_FILE (16 * 1024 * 1024) // bytes below which files are filtered by one thread
+#define BATCH_PATH_MAX 4096
+#define BATCH_OUTPUT "output_" // prefix of the outputs, written next to their inputs
+
+// buffers of one worker kept between files
+typedef struct BatchWorker {
+    PlyCloud cloud;
+    Octree octree;
+    MaskWord *keep;
+    long capacity;      // points of the keep-mask
+} BatchWorker;
+
+static int pathComp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void addPath(char ***paths, int *npaths, int *capacity, const char *path)
+{
+    if (*npaths == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        *paths = realloc(*paths, sizeof(char *) * *capacity);
+    }
+    (*paths)[(*npaths)++] = strdup(path);
+}
+
+// does a file name end with an extension?
+static int hasExtension(const char *name, const char *extension)
+{
+    size_t len = strlen(name), extLen = strlen(extension);
+    return len > extLen && !strcmp(name + len - extLen, extension);
+}
+
+// PLY files and containers of a directory but the outputs of a previous run,
+// or paths listed one per line in a text file
+static char **listFiles(const char *source, int *npaths)
+{
+    char **paths = NULL, path[BATCH_PATH_MAX], *end;
+    int capacity = 0;
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+    FILE *list;
+
+    *npaths = 0;
+    if (stat(source, &st))
+        return NULL;
+    if (S_ISDIR(st.st_mode)) {
+        dir = opendir(source);
+        if (!dir)
+            return NULL;
+        while ((entry = readdir(dir))) {
+            if ((!hasExtension(entry->d_name, ".ply") && !hasExtension(entry->d_name, PACK_EXTENSION)) ||
+                    !strncmp(entry->d_name, BATCH_OUTPUT, strlen(BATCH_OUTPUT)))
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+            addPath(&paths, npaths, &capacity, path);
+        }
+        closedir(dir);
+        qsort(paths, *npaths, sizeof(char *), pathComp);
+        return paths;
+    }
+
+    list = fopen(source, "r");
+    if (!list)
+        return NULL;
+    while (fgets(path, sizeof(path), list)) {
+        for (end = path + strlen(path); end > path && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '); end--)
+            ;
+        *end = '\0';
+        if (path[0])
+            addPath(&paths, npaths, &capacity, path);
+    }
+    fclose(list);
+    return paths;
+}
+
+// output of a file is output_<name> in its directory, so that files of the
+// same name in different directories don't clash. The output of a container
+// is a PLY file output_<name>.ply
+static void outputName(const char *path, char *output)
+{
+    const char *name = strrchr(path, '/');
+    int dirLength = name ? name + 1 - path : 0;
+
+    name = name ? name + 1 : path;
+    snprintf(output, BATCH_PATH_MAX + 16, "%.*s%s%s%s", dirLength, path, BATCH_OUTPUT, name,
+        hasExtension(name, PACK_EXTENSION) ? ".ply" : "");
+}
+
+// filters one file with the buffers of a worker. Its noise comes from its own
+// seed, whichever thread filters it. Returns the number of kept points, -1 on failure
+static long filterFile(BatchWorker *worker, const char *path, const FilterParams *params, unsigned int seed,
+    long *size)
+{
+    PlyCloud *cloud = &worker->cloud;
+    char output[BATCH_PATH_MAX + 16];
+    long resultSize = 0, i;
+
+    *size = 0;
+    if (!reloadPly(path, cloud))
+        return -1;
+    *size = cloud->size;
+    if (params->noiseProb) {
+        for (i = 0; i < cloud->size; i++) {
+            if ((double)rand_r(&seed) / (double)RAND_MAX < params->noiseProb) {
+                cloud->points[i].x += AWGN_generator_r(&seed);
+                cloud->points[i].y += AWGN_generator_r(&seed);
+                cloud->points[i].z += AWGN_generator_r(&seed);
+            }
+        }
+    }
+    if (cloud->size > worker->capacity) {
+        free(worker->keep);
+        worker->keep = allocMask(cloud->size);
+        worker->capacity = cloud->size;
+    }
+
+    if (cloud->size > 0) {
+        buildOctree(&worker->octree, cloud->points, cloud->size, params->bucketSize, params->maxDepth);
+        if (params->filterType == 'R')
+            RORfilterMask(&worker->octree, params->k, params->radius, 0, cloud->size, worker->keep);
+        else
+            SORfilterMask(&worker->octree, cloud->size, params->k, params->radius, worker->keep);
+        resetOctree(&worker->octree);
+        // kept points are compacted in place, the cloud is reloaded by the next file
+        resultSize = compactMask(worker->keep, cloud->size, (char *) cloud->points, sizeof(Point),
+            (char *) cloud->points);
+        if (cloud->attributes && cloud->layout.nattributes)
+            compactMask(worker->keep, cloud->size, cloud->attributes, cloud->layout.attrStride, cloud->attributes);
+    }
+
+    outputName(path, output);
+    if (!writePly(output, cloud, NULL, resultSize, params->binary))
+        return -1;
+    return resultSize;
+}
+
+static void reportFile(const char *path, long size, long kept)
+{
+    #pragma omp critical(batchReport)
+    {
+        if (kept < 0)
+            fprintf(stderr, "Failed to filter PLY file %s\n", path);
+        else
+            printf("%s: %ld points, %ld kept\n", path, size, kept);
+    }
+}
+
+// filters every file of a directory or of a list. total and kept are summed over
+// the files. Returns the number of files which failed, -1 if there is no file
+int filterBatch(const char *source, const FilterParams *params, long *total, long *kept)
+{
+    BatchWorker *workers;
+    struct stat st;
+    char **paths;
+    char *small;
+    long sum = 0, keptSum = 0;
+    int npaths, nworkers, failed = 0, f;
+    unsigned int seed = rand(); // file f is noised from seed + f
+
+    *total = 0;
+    *kept = 0;
+    paths = listFiles(source, &npaths);
+    if (!npaths) {
+        free(paths);
+        return -1;
+    }
+    small = malloc(npaths);
+    for (f = 0; f < npaths; f++)
+        small[f] = !stat(paths[f], &st) && st.st_size < BATCH_SMALL_FILE;
+
+    nworkers = omp_get_max_threads();
+    workers = calloc(nworkers, sizeof(BatchWorker));
+    for (f = 0; f < nworkers; f++) {
+        initOctree(&workers[f].octree);
+        workers[f].octree.ownsPoints = 0;
+    }
+
+    // small files are spread across threads, filters inside run serially
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:sum, keptSum, failed)
+    for (f = 0; f < npaths; f++) {
+        long size, result;
+        double span;
+        if (!small[f])
+            continue;
+        span = traceBegin();
+        result = filterFile(&workers[omp_get_thread_num()], paths[f], params, seed + f, &size);
+        traceEnd("small file", span);
+        reportFile(paths[f], size, result);
+        sum += size;
+        keptSum += result > 0 ? result : 0;
+        failed += result < 0;
+    }
+
+    // large ones are filtered one by one by all threads
+    for (f = 0; f < npaths; f++) {
+        long size, result;
+        double span;
+        if (small[f])
+            continue;
+        span = traceBegin();
+        result = filterFile(&workers[0], paths[f], params, seed + f, &size);
+        traceEnd("large file", span);
+        reportFile(paths[f], size, result);
+        sum += size;
+        keptSum += result > 0 ? result : 0;
+        failed += result < 0;
+    }
+
+    for (f = 0; f < nworkers; f++) {
+        freePlyCloud(&workers[f].cloud);
+        clearOctree(&workers[f].octree);
+        free(workers[f].keep);
+    }
+    for (f = 0; f < npaths; f++)
+        free(paths[f]);
+    free(workers);
+    free(paths);
+    free(small);
+    *total = sum;
+    *kept = keptSum;
+    return failed;
+}
@@ -0,0 +1,13 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ply_io.h"
+
+// filtering of many files in one process with the same parameters. The point
+// buffers, octree arrays and index arrays of a worker are reset and reused from
+// one file to the next, small files are filtered concurrently, one per thread,
+// and large ones one after another with all threads
+
+int filterBatch(const char *, const FilterParams *, long *, long *);
+
+#endif
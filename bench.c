@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <time.h>
+#include <omp.h>
+
+#include "my_octree.h"
+#include "mask.h"
+#include "synth.h"
+
+// benchmarks of the octree build, queries and filters on synthetic clouds.
+// Every run is repeated and its timings are printed as CSV lines, one per
+// benchmark, generator, size and parameters:
+// bench,generator,points,k,radius,threads,samples,median_us,p90_us,p99_us,min_us,max_us
+
+#define BENCH_SEED 20240601UL
+#define BENCH_QUERIES 1000 // single queries timed one by one per repetition
+#define BENCH_MAX_SIZES 16
+
+static const long defaultSizes[] = { 10000, 100000 };
+static const int benchKs[] = { 8, 32 };
+static const float radiusFactors[] = { 2.0f, 4.0f }; // ROR radii in point spacings
+
+typedef struct BenchConfig {
+    int reps;
+    long sizes[BENCH_MAX_SIZES];
+    int nsizes;
+    const char *generator;  // all generators if NULL
+    const char *bench;      // all benchmarks if NULL
+    int bucketSize;         // of the octrees
+} BenchConfig;
+
+static double nowMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int doubleComp(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, long count, double p)
+{
+    long rank = (long) (p / 100.0 * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank > count ? count - 1 : rank - 1];
+}
+
+static void report(const char *bench, const char *generator, long n, int k, float radius,
+    double *samples, long count)
+{
+    qsort(samples, count, sizeof(double), doubleComp);
+    printf("%s,%s,%ld,%d,%g,%d,%ld,%.3f,%.3f,%.3f,%.3f,%.3f\n", bench, generator, n, k, radius,
+        omp_get_max_threads(), count, percentile(samples, count, 50.0), percentile(samples, count, 90.0),
+        percentile(samples, count, 99.0), samples[0], samples[count - 1]);
+    fflush(stdout);
+}
+
+static int selected(const BenchConfig *config, const char *bench)
+{
+    return !config->bench || !strcmp(config->bench, bench);
+}
+
+// a fresh octree for every repetition, so that allocation is part of the build
+static void benchBuild(const BenchConfig *config, const char *generator, Point *pts, long n, double *samples)
+{
+    Octree octree;
+    double start;
+    int r;
+
+    for (r = 0; r < config->reps; r++) {
+        initOctree(&octree);
+        octree.ownsPoints = 0;
+        start = nowMicros();
+        buildOctree(&octree, pts, n, config->bucketSize, MAX_DEPTH);
+        samples[r] = nowMicros() - start;
+        clearOctree(&octree);
+    }
+    report("build", generator, n, 0, 0.0f, samples, config->reps);
+}
+
+// latencies of single k nearest neighbors queries on one thread, queries are
+// points of the cloud spread over the array
+static void benchQuery(const BenchConfig *config, const char *generator, Octree *octree, long n, int k,
+    double *samples)
+{
+    Point *neighbors;
+    float *dists;
+    double start;
+    long q, count = 0;
+    int r, size;
+
+    for (r = 0; r < config->reps; r++) {
+        for (q = 0; q < BENCH_QUERIES; q++) {
+            size = 0;
+            start = nowMicros();
+            findKNearest(octree, octree->points[q * (n / BENCH_QUERIES)], k, FLT_MAX, &neighbors, &size,
+                SOR_FILTER, &dists);
+            samples[count++] = nowMicros() - start;
+            free(neighbors);
+            free(dists);
+        }
+    }
+    report("query", generator, n, k, 0.0f, samples, count);
+}
+
+// k nearest neighbors of every point, queried by all threads as the filters do
+static void benchBatchQuery(const BenchConfig *config, const char *generator, Octree *octree, long n, int k,
+    double *samples)
+{
+    double start;
+    long i;
+    int r;
+
+    for (r = 0; r < config->reps; r++) {
+        start = nowMicros();
+        #pragma omp parallel
+        {
+            Point *neighbors;
+            float *dists;
+            int size;
+
+            #pragma omp for schedule(dynamic, 64)
+            for (i = 0; i < n; i++) {
+                size = 0;
+                findKNearest(octree, octree->points[i], k, FLT_MAX, &neighbors, &size, SOR_FILTER, &dists);
+                free(neighbors);
+                free(dists);
+            }
+        }
+        samples[r] = nowMicros() - start;
+    }
+    report("batch_query", generator, n, k, 0.0f, samples, config->reps);
+}
+
+static void benchFilter(const BenchConfig *config, const char *generator, Octree *octree, long n, int k,
+    float radius, char filterType, MaskWord *keep, double *samples)
+{
+    double start;
+    int r;
+
+    for (r = 0; r < config->reps; r++) {
+        start = nowMicros();
+        if (filterType == 'R')
+            RORfilterMask(octree, k, radius, 0, n, keep);
+        else
+            SORfilterMask(octree, n, k, radius, keep);
+        samples[r] = nowMicros() - start;
+    }
+    report(filterType == 'R' ? "ror" : "sor", generator, n, k, radius, samples, config->reps);
+}
+
+static void benchCloud(const BenchConfig *config, const char *generator, long n)
+{
+    Point *pts = malloc(sizeof(Point) * n);
+    double *samples = malloc(sizeof(double) * (config->reps * BENCH_QUERIES));
+    MaskWord *keep = allocMask(n);
+    float spacing = synthSpacing(generator, n);
+    Octree octree;
+    int i, j;
+
+    generateCloud(generator, n, BENCH_SEED, pts);
+    if (selected(config, "build"))
+        benchBuild(config, generator, pts, n, samples);
+
+    initOctree(&octree);
+    octree.ownsPoints = 0;
+    buildOctree(&octree, pts, n, config->bucketSize, MAX_DEPTH);
+    for (i = 0; i < (int) (sizeof(benchKs) / sizeof(int)); i++) {
+        if (selected(config, "query"))
+            benchQuery(config, generator, &octree, n, benchKs[i], samples);
+        if (selected(config, "batch_query"))
+            benchBatchQuery(config, generator, &octree, n, benchKs[i], samples);
+        for (j = 0; selected(config, "ror") && j < (int) (sizeof(radiusFactors) / sizeof(float)); j++)
+            benchFilter(config, generator, &octree, n, benchKs[i], radiusFactors[j] * spacing, 'R', keep, samples);
+        if (selected(config, "sor"))
+            benchFilter(config, generator, &octree, n, benchKs[i], 1.0f, 'S', keep, samples);
+    }
+
+    clearOctree(&octree);
+    free(keep);
+    free(samples);
+    free(pts);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--reps N] [--sizes N,N,...] [--gen NAME] [--bench NAME] [--bucket N]\n"
+        " generators: uniform blobs facades scan duplicates\n"
+        " benchmarks: build query batch_query ror sor\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config;
+    char *size;
+    int i, g, s;
+
+    memset(&config, 0, sizeof(BenchConfig));
+    config.reps = 5;
+    config.bucketSize = BUCKET_SIZE;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            config.reps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            for (size = strtok(argv[++i], ","); size && config.nsizes < BENCH_MAX_SIZES; size = strtok(NULL, ","))
+                config.sizes[config.nsizes++] = atol(size);
+        }
+        else if (!strcmp(argv[i], "--gen") && i + 1 < argc)
+            config.generator = argv[++i];
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+            config.bench = argv[++i];
+        else if (!strcmp(argv[i], "--bucket") && i + 1 < argc)
+            config.bucketSize = atoi(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+    for (g = 0; config.generator && synthNames[g] && strcmp(config.generator, synthNames[g]); g++)
+        ;
+    if (config.reps < 1 || config.bucketSize < 1 || (config.generator && !synthNames[g]))
+        usage(argv[0]);
+    if (!config.nsizes) {
+        config.nsizes = sizeof(defaultSizes) / sizeof(long);
+        memcpy(config.sizes, defaultSizes, sizeof(defaultSizes));
+    }
+    for (s = 0; s < config.nsizes; s++)
+        if (config.sizes[s] < BENCH_QUERIES)
+            usage(argv[0]);
+
+    printf("bench,generator,points,k,radius,threads,samples,median_us,p90_us,p99_us,min_us,max_us\n");
+    for (g = 0; synthNames[g]; g++) {
+        if (config.generator && strcmp(config.generator, synthNames[g]))
+            continue;
+        for (s = 0; s < config.nsizes; s++)
+            benchCloud(&config, synthNames[g], config.sizes[s]);
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "brute.h"
+
+void initBruteCloud(BruteCloud *cloud, const Point *pts, PointIndex size)
+{
+    PointIndex i;
+
+    cloud->x = malloc(sizeof(float) * size);
+    cloud->y = malloc(sizeof(float) * size);
+    cloud->z = malloc(sizeof(float) * size);
+    cloud->size = size;
+    for (i = 0; i < size; i++) {
+        cloud->x[i] = pts[i].x;
+        cloud->y[i] = pts[i].y;
+        cloud->z[i] = pts[i].z;
+    }
+}
+
+void freeBruteCloud(BruteCloud *cloud)
+{
+    free(cloud->x);
+    free(cloud->y);
+    free(cloud->z);
+    memset(cloud, 0, sizeof(BruteCloud));
+}
+
+static Point cloudPoint(const BruteCloud *cloud, PointIndex i)
+{
+    Point p;
+    p.x = cloud->x[i];
+    p.y = cloud->y[i];
+    p.z = cloud->z[i];
+    return p;
+}
+
+// number of candidates of the tile starting at begin
+static int tileSize(const BruteCloud *cloud, PointIndex begin)
+{
+    return cloud->size - begin < BRUTE_TILE ? cloud->size - begin : BRUTE_TILE;
+}
+
+// squared distances from the query to the candidates [begin, begin + count)
+static void tileDists(const BruteCloud *cloud, Point query, PointIndex begin, int count, float *dists)
+{
+    const float *x = cloud->x + begin, *y = cloud->y + begin, *z = cloud->z + begin;
+    float dx, dy, dz;
+    int j;
+
+    for (j = 0; j < count; j++) {
+        dx = x[j] - query.x;
+        dy = y[j] - query.y;
+        dz = z[j] - query.z;
+        dists[j] = dx * dx + dy * dy + dz * dz;
+    }
+}
+
+static PointIndex countWithin(const float *dists, int count, float sqrRadius)
+{
+    PointIndex within = 0;
+    int j;
+
+    for (j = 0; j < count; j++)
+        within += dists[j] > 0 && dists[j] < sqrRadius;
+    return within;
+}
+
+// number of points at squared distances in (0, sqrRadius) from the query
+PointIndex bruteRadiusCount(const BruteCloud *cloud, Point query, float sqrRadius)
+{
+    float dists[BRUTE_TILE];
+    PointIndex c, within = 0;
+    int tile;
+
+    for (c = 0; c < cloud->size; c += BRUTE_TILE) {
+        tile = tileSize(cloud, c);
+        tileDists(cloud, query, c, tile, dists);
+        within += countWithin(dists, tile, sqrRadius);
+    }
+    return within;
+}
+
+// ROR filtering of all points into a keep-mask: a point stays with at least k
+// points within the radius. Every tile of candidates is compared with all
+// queries of a block while it is in cache
+void bruteRORfilterMask(const BruteCloud *cloud, int k, float radius, MaskWord *keep)
+{
+    float sqrRadius = radius * radius;
+    PointIndex w;
+
+    #pragma omp parallel
+    {
+        float dists[BRUTE_TILE];
+        PointIndex counts[BRUTE_QUERIES];
+        PointIndex begin, end, c, i;
+        MaskWord bits;
+        int tile;
+
+        #pragma omp for schedule(dynamic)
+        for (w = 0; w < maskWords(cloud->size); w++) {
+            begin = w * BRUTE_QUERIES;
+            end = begin + BRUTE_QUERIES < cloud->size ? begin + BRUTE_QUERIES : cloud->size;
+            memset(counts, 0, sizeof(counts));
+            for (c = 0; c < cloud->size; c += BRUTE_TILE) {
+                tile = tileSize(cloud, c);
+                for (i = begin; i < end; i++) {
+                    tileDists(cloud, cloudPoint(cloud, i), c, tile, dists);
+                    counts[i - begin] += countWithin(dists, tile, sqrRadius);
+                }
+            }
+            bits = 0;
+            for (i = begin; i < end; i++)
+                if (counts[i - begin] >= k)
+                    bits |= 1UL << (i - begin);
+            keep[w] = bits;
+        }
+    }
+}
+
+// inserting the candidates closer than the farthest of k sorted nearest
+// distances, found of them are filled
+static void insertNearest(const float *dists, int count, int k, float *nearest, int *found)
+{
+    float bound = *found == k ? nearest[k - 1] : FLT_MAX;
+    int j, m;
+
+    for (j = 0; j < count; j++) {
+        if (dists[j] <= 0 || dists[j] >= bound)
+            continue;
+        if (*found < k)
+            (*found)++;
+        for (m = *found - 1; m > 0 && nearest[m - 1] > dists[j]; m--)
+            nearest[m] = nearest[m - 1];
+        nearest[m] = dists[j];
+        if (*found == k)
+            bound = nearest[k - 1];
+    }
+}
+
+// mean distances of all points to their k nearest neighbors, NaN for points
+// without any as the octree gives
+void bruteSORmeanDists(const BruteCloud *cloud, int k, float *meanDists)
+{
+    PointIndex b;
+
+    #pragma omp parallel
+    {
+        float dists[BRUTE_TILE];
+        float *nearest = malloc(sizeof(float) * BRUTE_QUERIES * k);
+        int found[BRUTE_QUERIES];
+        PointIndex begin, end, c, i;
+        float sum;
+        int tile, j;
+
+        #pragma omp for schedule(dynamic)
+        for (b = 0; b < (cloud->size + BRUTE_QUERIES - 1) / BRUTE_QUERIES; b++) {
+            begin = b * BRUTE_QUERIES;
+            end = begin + BRUTE_QUERIES < cloud->size ? begin + BRUTE_QUERIES : cloud->size;
+            memset(found, 0, sizeof(found));
+            for (c = 0; c < cloud->size; c += BRUTE_TILE) {
+                tile = tileSize(cloud, c);
+                for (i = begin; i < end; i++) {
+                    tileDists(cloud, cloudPoint(cloud, i), c, tile, dists);
+                    insertNearest(dists, tile, k, nearest + (i - begin) * k, &found[i - begin]);
+                }
+            }
+            for (i = begin; i < end; i++) {
+                sum = 0.0f;
+                for (j = 0; j < found[i - begin]; j++)
+                    sum += sqrtf(nearest[(i - begin) * k + j]);
+                meanDists[i] = sum / found[i - begin];
+            }
+        }
+        free(nearest);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef BRUTE_H
+#define BRUTE_H
+
+#include "my_octree.h"
+
+// brute-force reference of the filters: every point is compared with every
+// other one, so results don't depend on the octree. Neighbors follow the same
+// rules as the octree queries: points at a zero distance (the query itself and
+// its duplicates) aren't neighbors, distances to a radius are strictly less
+
+#define BRUTE_TILE 1024     // candidate points compared with a block of queries at once
+#define BRUTE_QUERIES MASK_BITS // queries of a block handed to a thread, a word of the keep-mask
+
+// coordinates as separate arrays, so that distances to a tile of candidates
+// are computed by loops the compiler can vectorize
+typedef struct BruteCloud {
+    float *x, *y, *z;
+    PointIndex size;
+} BruteCloud;
+
+void initBruteCloud(BruteCloud *, const Point *, PointIndex);
+void freeBruteCloud(BruteCloud *);
+
+PointIndex bruteRadiusCount(const BruteCloud *, Point, float);
+void bruteRORfilterMask(const BruteCloud *, int, float, MaskWord *);
+void bruteSORmeanDists(const BruteCloud *, int, float *);
+
+#endif
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "my_octree.h"
+#include "mask.h"
+#include "ply_io.h"
+#include "synth.h"
+#include "brute.h"
+
+// differential check of the octree filters against the brute-force reference
+// on synthetic clouds and PLY files. Both engines filter the same points and
+// their keep-masks are compared; a point kept by one of them only is a tie when
+// its neighbor count changes within CHECK_TOLERANCE of the squared radius (ROR)
+// or its mean distance is within it of the thresholds (SOR), as float rounding
+// of the distances may decide either way. Results are printed as CSV lines:
+// source,points,filter,k,param,threads,kept_octree,kept_brute,mismatches,ties,max_mean_error,build_ms,octree_ms,brute_ms,speedup
+// and the exit status is 1 when a mismatch isn't a tie
+
+#define CHECK_SEED 20240601UL
+#define CHECK_TOLERANCE 1e-4f // relative
+#define CHECK_MAX_SIZES 16
+#define CHECK_MAX_KS 8
+#define CHECK_READER_POINTS 1000 // of the ASCII cloud read without attributes
+
+static const long defaultSizes[] = { 2000, 10000 };
+static const int defaultKs[] = { 8, 32 };
+static const float radiusFactors[] = { 2.0f, 4.0f }; // ROR radii in point spacings of synthetic clouds
+
+typedef struct CheckConfig {
+    long sizes[CHECK_MAX_SIZES];
+    int nsizes;
+    int ks[CHECK_MAX_KS];
+    int nks;
+    const char *generator;  // all generators if NULL
+    char filterType;        // both filters if 0
+    float radius;           // ROR radius of files
+    float multiplier;
+    int bucketSize;         // of the octrees
+    int failed;             // comparisons with mismatches that aren't ties
+    int comparisons;
+} CheckConfig;
+
+// what one comparison of the engines found
+typedef struct CheckResult {
+    long keptOctree, keptBrute;
+    long mismatches, ties;
+    double maxMeanError;    // relative, of SOR mean distances
+    double buildMs, octreeMs, bruteMs;
+} CheckResult;
+
+static double nowMillis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void report(CheckConfig *config, const char *source, long n, char filterType, int k, float param,
+    const CheckResult *result)
+{
+    printf("%s,%ld,%s,%d,%g,%d,%ld,%ld,%ld,%ld,%.3g,%.3f,%.3f,%.3f,%.2f\n", source, n,
+        filterType == 'R' ? "ror" : "sor", k, param, omp_get_max_threads(), result->keptOctree,
+        result->keptBrute, result->mismatches, result->ties, result->maxMeanError, result->buildMs,
+        result->octreeMs, result->bruteMs, result->bruteMs / (result->buildMs + result->octreeMs));
+    fflush(stdout);
+    config->comparisons++;
+    if (result->mismatches > result->ties)
+        config->failed++;
+}
+
+static void checkROR(CheckConfig *config, const char *source, Octree *octree, const BruteCloud *brute, int k,
+    float radius, CheckResult *result)
+{
+    long n = brute->size, i;
+    MaskWord *keepOctree = allocMask(n), *keepBrute = allocMask(n);
+    float sqrRadius = radius * radius;
+    PointIndex low, high;
+    double start;
+
+    start = nowMillis();
+    RORfilterMask(octree, k, radius, 0, n, keepOctree);
+    result->octreeMs = nowMillis() - start;
+    start = nowMillis();
+    bruteRORfilterMask(brute, k, radius, keepBrute);
+    result->bruteMs = nowMillis() - start;
+
+    result->keptOctree = countMask(keepOctree, n);
+    result->keptBrute = countMask(keepBrute, n);
+    result->mismatches = result->ties = 0;
+    result->maxMeanError = 0.0;
+    for (i = 0; i < n; i++) {
+        if (testMask(keepOctree, i) == testMask(keepBrute, i))
+            continue;
+        result->mismatches++;
+        low = bruteRadiusCount(brute, octree->points[i], sqrRadius * (1.0f - CHECK_TOLERANCE));
+        high = bruteRadiusCount(brute, octree->points[i], sqrRadius * (1.0f + CHECK_TOLERANCE));
+        if (low < k && high >= k)
+            result->ties++;
+    }
+    report(config, source, n, 'R', k, radius, result);
+    free(keepOctree);
+    free(keepBrute);
+}
+
+static void checkSOR(CheckConfig *config, const char *source, Octree *octree, const BruteCloud *brute, int k,
+    CheckResult *result)
+{
+    long n = brute->size, i;
+    MaskWord *keepOctree = allocMask(n), *keepBrute = allocMask(n);
+    float *meanOctree = malloc(sizeof(float) * n), *meanBrute = malloc(sizeof(float) * n);
+    float thresholdOctree, thresholdBrute, lowest, highest;
+    double start, error;
+
+    start = nowMillis();
+    SORmeanDists(octree, k, 0, n, meanOctree);
+    thresholdOctree = SORthreshold(meanOctree, NULL, n, config->multiplier);
+    SORselectMask(meanOctree, 0, n, thresholdOctree, keepOctree);
+    result->octreeMs = nowMillis() - start;
+    start = nowMillis();
+    bruteSORmeanDists(brute, k, meanBrute);
+    thresholdBrute = SORthreshold(meanBrute, NULL, n, config->multiplier);
+    SORselectMask(meanBrute, 0, n, thresholdBrute, keepBrute);
+    result->bruteMs = nowMillis() - start;
+
+    lowest = (thresholdOctree < thresholdBrute ? thresholdOctree : thresholdBrute) * (1.0f - CHECK_TOLERANCE);
+    highest = (thresholdOctree > thresholdBrute ? thresholdOctree : thresholdBrute) * (1.0f + CHECK_TOLERANCE);
+    result->keptOctree = countMask(keepOctree, n);
+    result->keptBrute = countMask(keepBrute, n);
+    result->mismatches = result->ties = 0;
+    result->maxMeanError = 0.0;
+    for (i = 0; i < n; i++) {
+        // points without neighbors have NaN mean distances in both engines
+        if (!isnan(meanOctree[i]) && !isnan(meanBrute[i]) && meanBrute[i] > 0) {
+            error = fabs(meanOctree[i] - meanBrute[i]) / meanBrute[i];
+            if (error > result->maxMeanError)
+                result->maxMeanError = error;
+        }
+        if (testMask(keepOctree, i) == testMask(keepBrute, i))
+            continue;
+        result->mismatches++;
+        if (meanBrute[i] >= lowest && meanBrute[i] <= highest)
+            result->ties++;
+    }
+    report(config, source, n, 'S', k, config->multiplier, result);
+    free(meanOctree);
+    free(meanBrute);
+    free(keepOctree);
+    free(keepBrute);
+}
+
+// both filters of every k on one cloud, ROR with the given radii
+static void checkCloud(CheckConfig *config, const char *source, Point *pts, long n, const float *radii,
+    int nradii)
+{
+    Octree octree;
+    BruteCloud brute;
+    CheckResult result;
+    double start;
+    int i, j;
+
+    initOctree(&octree);
+    octree.ownsPoints = 0;
+    start = nowMillis();
+    buildOctree(&octree, pts, n, config->bucketSize, MAX_DEPTH);
+    result.buildMs = nowMillis() - start;
+    initBruteCloud(&brute, pts, n);
+
+    for (i = 0; i < config->nks; i++) {
+        for (j = 0; config->filterType != 'S' && j < nradii; j++)
+            checkROR(config, source, &octree, &brute, config->ks[i], radii[j], &result);
+        if (config->filterType != 'R')
+            checkSOR(config, source, &octree, &brute, config->ks[i], &result);
+    }
+
+    freeBruteCloud(&brute);
+    clearOctree(&octree);
+}
+
+static void checkGenerated(CheckConfig *config, const char *generator, long n)
+{
+    Point *pts = malloc(sizeof(Point) * n);
+    float spacing = synthSpacing(generator, n), radii[2];
+    int j;
+
+    generateCloud(generator, n, CHECK_SEED, pts);
+    for (j = 0; j < 2; j++)
+        radii[j] = radiusFactors[j] * spacing;
+    checkCloud(config, generator, pts, n, radii, 2);
+    free(pts);
+}
+
+static void checkFile(CheckConfig *config, const char *filename)
+{
+    PlyCloud cloud;
+
+    if (!readPly(filename, &cloud)) {
+        fprintf(stderr, "Failed to read from PLY file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    checkCloud(config, filename, cloud.points, cloud.size, &config->radius, 1);
+    freePlyCloud(&cloud);
+}
+
+// an ASCII cloud with vertex properties around x, y, z is streamed without its
+// attributes, which must not change the points read with them
+static void checkAsciiReader(CheckConfig *config)
+{
+    char path[4096];
+    const char *dir = getenv("TMPDIR");
+    Point *pts = malloc(sizeof(Point) * CHECK_READER_POINTS);
+    PlyCloud cloud;
+    PlyReader reader;
+    FILE *file;
+    long i, n, mismatches = 0;
+
+    snprintf(path, sizeof(path), "%s/octree_check_%d.ply", dir ? dir : "/tmp", (int) getpid());
+    generateCloud("uniform", CHECK_READER_POINTS, CHECK_SEED, pts);
+    file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(file, "ply\nformat ascii 1.0\nelement vertex %d\nproperty uchar red\nproperty float x\n"
+        "property float y\nproperty float z\nproperty uchar green\nproperty double intensity\n"
+        "property float confidence\nend_header\n", CHECK_READER_POINTS);
+    for (i = 0; i < CHECK_READER_POINTS; i++)
+        fprintf(file, "%ld %.6f %.6f %.6f %ld %.6f %.6f\n", i % 256, pts[i].x, pts[i].y, pts[i].z,
+            (i * 7) % 256, i * 0.5, 1.0 / (i + 1));
+    fclose(file);
+
+    if (!readPly(path, &cloud) || !openPlyReader(path, &reader)) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    n = readPlyBlock(&reader, pts, NULL, CHECK_READER_POINTS);
+    for (i = 0; i < n && i < cloud.size; i++)
+        if (memcmp(&pts[i], &cloud.points[i], sizeof(Point)))
+            mismatches++;
+    if (n != cloud.size || mismatches) {
+        fprintf(stderr, "ASCII points read without attributes: %ld of %ld read, %ld differ\n",
+            n, cloud.size, mismatches);
+        config->failed++;
+    }
+    config->comparisons++;
+    closePlyReader(&reader);
+    freePlyCloud(&cloud);
+    remove(path);
+    free(pts);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--sizes N,N,...] [--gen NAME] [--k K,K,...] [--filter R|S] [--radius R]\n"
+        "  [--multiplier M] [--bucket N] [file.ply ...]\n"
+        " generators: uniform blobs facades scan duplicates, files are filtered with --radius (1 by default)\n",
+        name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    CheckConfig config;
+    char *item;
+    int i, g, s, nfiles = 0;
+
+    memset(&config, 0, sizeof(CheckConfig));
+    config.radius = 1.0f;
+    config.multiplier = 1.0f;
+    config.bucketSize = BUCKET_SIZE;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            for (item = strtok(argv[++i], ","); item && config.nsizes < CHECK_MAX_SIZES; item = strtok(NULL, ","))
+                config.sizes[config.nsizes++] = atol(item);
+        }
+        else if (!strcmp(argv[i], "--k") && i + 1 < argc) {
+            for (item = strtok(argv[++i], ","); item && config.nks < CHECK_MAX_KS; item = strtok(NULL, ","))
+                config.ks[config.nks++] = atoi(item);
+        }
+        else if (!strcmp(argv[i], "--gen") && i + 1 < argc)
+            config.generator = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            config.filterType = argv[++i][0];
+        else if (!strcmp(argv[i], "--radius") && i + 1 < argc)
+            config.radius = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--multiplier") && i + 1 < argc)
+            config.multiplier = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--bucket") && i + 1 < argc)
+            config.bucketSize = atoi(argv[++i]);
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            nfiles++;
+    }
+    for (g = 0; config.generator && synthNames[g] && strcmp(config.generator, synthNames[g]); g++)
+        ;
+    if ((config.generator && !synthNames[g]) || (config.filterType && config.filterType != 'R' &&
+        config.filterType != 'S') || config.radius <= 0.0f || config.bucketSize < 1)
+        usage(argv[0]);
+    for (i = 0; i < config.nks; i++)
+        if (config.ks[i] < 1)
+            usage(argv[0]);
+    if (!config.nsizes) {
+        config.nsizes = sizeof(defaultSizes) / sizeof(long);
+        memcpy(config.sizes, defaultSizes, sizeof(defaultSizes));
+    }
+    if (!config.nks) {
+        config.nks = sizeof(defaultKs) / sizeof(int);
+        memcpy(config.ks, defaultKs, sizeof(defaultKs));
+    }
+
+    printf("source,points,filter,k,param,threads,kept_octree,kept_brute,mismatches,ties,max_mean_error,"
+        "build_ms,octree_ms,brute_ms,speedup\n");
+    checkAsciiReader(&config);
+    // files only when some are given, generated clouds otherwise or with --gen
+    for (g = 0; synthNames[g] && (!nfiles || config.generator); g++) {
+        if (config.generator && strcmp(config.generator, synthNames[g]))
+            continue;
+        for (s = 0; s < config.nsizes; s++)
+            if (config.sizes[s] > 1)
+                checkGenerated(&config, synthNames[g], config.sizes[s]);
+    }
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] == '-')
+            i++;
+        else
+            checkFile(&config, argv[i]);
+    }
+
+    fprintf(stderr, "%d comparisons, %d with mismatches that aren't ties\n", config.comparisons, config.failed);
+    return config.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
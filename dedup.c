@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "mask.h"
+#include "alloc.h"
+
+// a point with its index, sorted by coordinates so that copies are adjacent
+// and the first copy comes first
+typedef struct SortedPoint {
+    Point p;
+    PointIndex index;
+} SortedPoint;
+
+static int sortedComp(const void *a, const void *b)
+{
+    const SortedPoint *x = a, *y = b;
+
+    if (x->p.x != y->p.x)
+        return (x->p.x > y->p.x) - (x->p.x < y->p.x);
+    if (x->p.y != y->p.y)
+        return (x->p.y > y->p.y) - (x->p.y < y->p.y);
+    if (x->p.z != y->p.z)
+        return (x->p.z > y->p.z) - (x->p.z < y->p.z);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static int samePoint(Point a, Point b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+void dedupCloud(const Point *pts, PointIndex n, Dedup *dedup)
+{
+    SortedPoint *sorted = malloc(sizeof(SortedPoint) * (n > 0 ? n : 1));
+    PointIndex *unique = malloc(sizeof(PointIndex) * (n > 0 ? n : 1));
+    PointIndex i, j, m, u = 0;
+
+    countAlloc(ALLOC_DEDUP, (long) (sizeof(SortedPoint) + sizeof(PointIndex)) * n);
+    for (i = 0; i < n; i++) {
+        sorted[i].p = pts[i];
+        sorted[i].index = i;
+    }
+    qsort(sorted, n, sizeof(SortedPoint), sortedComp);
+
+    // every point gets the index of its first copy
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && samePoint(sorted[j].p, sorted[i].p); j++)
+            ;
+        for (m = i; m < j; m++)
+            unique[sorted[m].index] = sorted[i].index;
+        u++;
+    }
+    free(sorted);
+    countFree(ALLOC_DEDUP, (long) sizeof(SortedPoint) * n);
+
+    // first copies are numbered in order, the others take the number of their
+    // first copy, which comes before them
+    dedup->points = malloc(sizeof(Point) * (u > 0 ? u : 1));
+    dedup->weights = calloc(u > 0 ? u : 1, sizeof(PointIndex));
+    dedup->size = 0;
+    dedup->count = n;
+    countAlloc(ALLOC_DEDUP, (long) (sizeof(Point) + sizeof(PointIndex)) * u);
+    for (i = 0; i < n; i++) {
+        if (unique[i] == i) {
+            dedup->points[dedup->size] = pts[i];
+            unique[i] = dedup->size++;
+        }
+        else
+            unique[i] = unique[unique[i]];
+        dedup->weights[unique[i]]++;
+    }
+    dedup->unique = unique;
+}
+
+// most bytes merging copies of n points holds, when none of them are copies
+long dedupBytes(long n)
+{
+    long sorting = sizeof(SortedPoint), numbering = sizeof(Point) + sizeof(PointIndex);
+
+    return (sizeof(PointIndex) + (sorting > numbering ? sorting : numbering)) * n;
+}
+
+void freeDedup(Dedup *dedup)
+{
+    countFree(ALLOC_DEDUP, (long) (sizeof(Point) + sizeof(PointIndex)) * dedup->size +
+        (long) sizeof(PointIndex) * dedup->count);
+    free(dedup->points);
+    free(dedup->weights);
+    free(dedup->unique);
+    memset(dedup, 0, sizeof(Dedup));
+}
+
+// keep-mask of the n points of the cloud from that of the unique points,
+// every copy is kept with its unique point
+void expandMask(const Dedup *dedup, const MaskWord *uniqueKeep, PointIndex n, MaskWord *keep)
+{
+    PointIndex w, i;
+    MaskWord bits;
+
+    #pragma omp parallel for private(i, bits)
+    for (w = 0; w < maskWords(n); w++) {
+        bits = 0;
+        for (i = w * MASK_BITS; i < n && i < (w + 1) * MASK_BITS; i++)
+            if (testMask(uniqueKeep, dedup->unique[i]))
+                bits |= 1UL << (i - w * MASK_BITS);
+        keep[w] = bits;
+    }
+}
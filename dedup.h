@@ -0,0 +1,24 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "my_octree.h"
+
+// exact duplicates of a cloud merged into unique points weighted by their
+// number of copies. An octree of the unique points with the weights counts
+// the copies of a point as its neighbors at a zero distance, and filters decide
+// once for all copies; the decisions are then spread back to every point
+
+typedef struct Dedup {
+    Point *points;          // unique points in the order of their first copy
+    PointIndex *weights;    // copies of every unique point
+    PointIndex *unique;     // unique point of every point of the cloud
+    PointIndex size;        // of unique points
+    PointIndex count;       // of points of the cloud
+} Dedup;
+
+void dedupCloud(const Point *, PointIndex, Dedup *);
+void freeDedup(Dedup *);
+long dedupBytes(long);
+void expandMask(const Dedup *, const MaskWord *, PointIndex, MaskWord *);
+
+#endif
@@ -3,59 +3,113 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
-#include <sys/time.h>
 #include "rply.h"
 
 #include "my_octree.h"
+#include "ply_io.h"
+#include "tiles.h"
+#include "batch.h"
+#include "octree_index.h"
+#include "dedup.h"
+#include "pack.h"
+#include "mask.h"
+#include "timing.h"
+#include "trace.h"
+#include "tune.h"
+#include "alloc.h"
+#ifdef USE_MPI
+#include "my_mpi.h"
+#endif
 
-// callback function for PLY file reading
-static int vertex_cb(p_ply_argument argument) 
+// reading the whole PLY file
+void readPlyFile(char* filename, PlyCloud *cloud)
 {
-    static int i = 0;
-    long flag;
-    ply_get_argument_user_data(argument, NULL, &flag);
-    switch (flag)
-    {
-        case 0:
-            inputpts[i].x = ply_get_argument_value(argument);
-            break;
-        case 1:
-            inputpts[i].y = ply_get_argument_value(argument);
-            break;
-        case 2:
-            inputpts[i++].z = ply_get_argument_value(argument);
-            break;
-        default:
-            break;
-    }
-    return 1;
+    if (!readPly(filename, cloud)) {
+        fprintf(stderr, "Failed to read from PLY file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// spans of all threads written into a trace file, of all processes for parallel runs
+void writeTraceFile(const char *tracePath, int rank)
+{
+    int ok;
+#ifdef USE_MPI
+    ok = mpiWriteTrace(MPI_COMM_WORLD, tracePath);
+#else
+    long length;
+    char *events = formatTrace(&length);
+    ok = writeTrace(tracePath, events, length);
+    free(events);
+#endif
+    if (!ok && rank == 0)
+        fprintf(stderr, "Failed to write trace %s\n", tracePath);
 }
 
-void writePlyOutput(char* filename, Point* resultpts, int nvericies) {
-    char buff[512];
-    FILE* newPlyFile = fopen(filename, "w");
-    fputs("ply\n\nformat ascii 1.0\n\ncomment Created By NextEngine ScanStudio\n\n", newPlyFile);
-    sprintf(buff, "element vertex %d\n\n", nvericies);
-    fputs(buff, newPlyFile);
-    fputs("property float x\n\nproperty float y\n\nproperty float z\n\nend_header\n\n", newPlyFile);
-    for (int i = 0; i < nvericies; i++) {
-        sprintf(buff, "%.6f %.6f %.6f\n", resultpts[i].x, resultpts[i].y, resultpts[i].z);
-        fputs(buff, newPlyFile);
-    }
-    fclose(newPlyFile);
+// prints the phase timings and writes them into a JSON report if one was asked for,
+// and the trace of the run if it was recorded
+void reportRun(Timings *timings, const char *reportPath, const char *tracePath, const RunInfo *info, int rank)
+{
+    if (tracePath)
+        writeTraceFile(tracePath, rank);
+#ifdef QUERY_STATS
+    QueryStats stats;
+    takeQueryStats(&stats);
+#ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &stats, sizeof(QueryStats) / sizeof(long), MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    if (rank == 0)
+        printQueryStats(&stats);
+#endif
+    if (rank != 0)
+        return;
+    if (info->memory)
+        printMemory("Memory of the run", info->memory);
+    printTimings(timings);
+    if (reportPath && !writeTimingReport(reportPath, timings, info))
+        fprintf(stderr, "Failed to write report %s\n", reportPath);
 }
 
 int main(int argc, char* argv[])
 { 
     // declaring variables
     Octree *testOctree;
-    int i, j;
+    int i;
     // added this
     char filterType;
-    int *indsToStay;
-    long nvertices, resultSize = 0, microseconds = 0;
-    struct timeval start, stop;
-    p_ply ply;
+    PointIndex *indsToStay = NULL;
+    MaskWord *keep = NULL;
+    long nvertices, resultSize = 0;
+    long first, count; // slice of the cloud noised and filtered by this process
+    int rank = 0, binary = 1;
+    float tileSize = 0.0f; // tiled out-of-core filtering if set
+    int batch = 0; // filename is a directory or a list of files
+    FilterParams params;
+    Timings timings; // of the phases of the run
+    RunInfo info;
+    char *reportPath = NULL; // JSON report of the timings if set
+    char *tracePath = NULL; // Chrome trace of the threads if set
+    double filterSeconds;
+    MemoryUsage memory;
+    int predict = 0; // only the memory of the run is predicted from the file header
+    int bucketSize = BUCKET_SIZE, maxDepth = MAX_DEPTH;
+    int tune = 0; // bucket size chosen by timing a sample of the queries
+    int dedup = 0; // exact copies of points are merged before the build
+    PlyCloud cloud;
+#ifdef USE_MPI
+    CloudSlice slice;
+    NodeComm nodeComm, *node = NULL;
+    int provided, status, shared = 0;
+#else
+    int useIndex = 0, indexed = 0; // octree index kept next to the file, opened from it
+    char indexPath[4096];
+    OctreeIndex index = { NULL, 0, 0, NULL };
+    double packResolution = 0.0; // output written as a compressed container if set
+    Dedup copies = { NULL, NULL, NULL, 0, 0 };
+    MaskWord *uniqueKeep = NULL; // of the unique points of a deduplicated cloud
+    Point *octreePts; // points the octree is built on, unique ones of a deduplicated cloud
+    long octreeSize;
+#endif
 
     // command line arguments
     char *filename; // PLY source file name
@@ -65,10 +119,16 @@ int main(int argc, char* argv[])
     int noise;
     float noiseProb;
 
-    srand(time(0));
+#ifdef USE_MPI
+    // threads only run inside of filters, MPI is called from the main one
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+    srand(time(0) + rank);
+    initTimings(&timings);
 
     //if (argc != 4) {
-    if (argc != 7) {
+    if (argc < 7) {
         //fprintf(stderr, "3 command line arguments must be passed: filename,\n min number of neighbors every point should have, search radius\n");
         fprintf(stderr, " 4 command line arguments must be passed: filename,\n min number of neighbors every point should have, search radius,\n noise type (G for Gaussian noise, N for none)\n");
         exit(EXIT_FAILURE);
@@ -90,31 +150,232 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
     noise = strcmp(argv[5], "Y") ? 1 : 0;
-   
-    // reading from a PLY file using RPly library
-    ply = ply_open(filename, NULL, 0, NULL);
-    if (!ply) {
-        fprintf(stderr, "File pointer is null\n");
+
+    // optional flags
+    for (i = 7; i < argc; i++) {
+        if (!strcmp(argv[i], "--ascii"))
+            binary = 0;
+        else if (!strcmp(argv[i], "--report") && i + 1 < argc)
+            reportPath = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (!strcmp(argv[i], "--predict"))
+            predict = 1;
+        else if (!strcmp(argv[i], "--bucket") && i + 1 < argc)
+            bucketSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+            maxDepth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tune"))
+            tune = 1;
+#ifndef USE_MPI
+        else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+            tileSize = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--batch"))
+            batch = 1;
+        else if (!strcmp(argv[i], "--index"))
+            useIndex = 1;
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc)
+            packResolution = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--dedup"))
+            dedup = 1;
+#endif
+#ifdef USE_MPI
+        else if (!strcmp(argv[i], "--shared"))
+            shared = 1;
+#endif
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    params.filterType = filterType;
+    params.k = k;
+    params.radius = rad;
+    params.noiseProb = noiseProb;
+    params.binary = binary;
+    params.tileSize = tileSize;
+    params.bucketSize = bucketSize;
+    params.maxDepth = maxDepth;
+    info.input = filename;
+    info.params = &params;
+    info.memory = NULL;
+    if (bucketSize < 1 || maxDepth < 0) {
+        if (rank == 0)
+            fprintf(stderr, "Bucket size must be positive and max depth not negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if (tune && (batch || tileSize > 0)) {
+        fprintf(stderr, "Tiled and batch runs don't tune the bucket size, it is set with --bucket\n");
         exit(EXIT_FAILURE);
     }
-    if (!ply_read_header(ply)) {
-        fprintf(stderr, "Failed to read PLY file header\n");
+    if (dedup && (batch || tileSize > 0)) {
+        fprintf(stderr, "Tiled and batch runs don't merge duplicate points\n");
         exit(EXIT_FAILURE);
     }
-    nvertices = ply_set_read_cb(ply, "vertex", "x", vertex_cb, NULL, 0);
-    ply_set_read_cb(ply, "vertex", "y", vertex_cb, NULL, 1);
-    ply_set_read_cb(ply, "vertex", "z", vertex_cb, NULL, 2);
-    printf("File contains %ld points\n", nvertices);
-    inputpts = malloc(sizeof(Point) * nvertices);
-    if (!ply_read(ply)) {
-        fprintf(stderr, "Failed to read from PLY file\n");
+#ifndef USE_MPI
+    if (useIndex && (batch || tileSize > 0)) {
+        fprintf(stderr, "Tiled and batch runs don't use an octree index\n");
         exit(EXIT_FAILURE);
     }
-    ply_close(ply);
+    if (packResolution > 0 && (batch || tileSize > 0)) {
+        fprintf(stderr, "Tiled and batch runs write PLY files only, not containers\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    // every process of a run holds the whole cloud and octree, their memory is
+    // predicted from the points of the file, which are read without being held
+    if (predict) {
+        RunShape shape = { timings.nthreads, 0, 0, dedup, 0 };
+        int predicted = 1;
+#ifdef USE_MPI
+        MPI_Comm_size(MPI_COMM_WORLD, &shape.nprocs);
+        shape.shared = shared;
+#else
+        shape.packed = packResolution > 0;
+#endif
+        if (rank == 0) {
+            predicted = predictMemory(filename, &params, &shape, &nvertices, &memory);
+            if (!predicted)
+                fprintf(stderr, "Failed to read PLY file %s\n", filename);
+        }
+        if (rank == 0 && predicted) {
+            printf("File contains %ld points\n", nvertices);
+            if (tileSize > 0 || batch)
+                printf("Tiled and batch runs hold a few tiles or files at once, the prediction is for the whole file\n");
+            printMemory("Predicted memory of a process", &memory);
+        }
+#ifdef USE_MPI
+        MPI_Finalize();
+#endif
+        return predicted ? 0 : EXIT_FAILURE;
+    }
+
+    // spans are timed from the same moment on all processes
+    if (tracePath) {
+#ifdef USE_MPI
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        enableTrace(rank);
+    }
+
+#ifndef USE_MPI
+    // many files are filtered in one process, reusing buffers between them
+    if (batch) {
+        long kept;
+        int failed;
+        beginPhase(&timings, "batch");
+        failed = filterBatch(filename, &params, &nvertices, &kept);
+        if (failed < 0) {
+            fprintf(stderr, "No PLY files found in %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        endPhase(&timings);
+        printf("Files contain %ld points, %ld kept, filtered in %f seconds\n",
+            nvertices, kept, phaseSeconds(&timings, "batch"));
+        info.mode = "batch";
+        info.points = nvertices;
+        info.kept = kept;
+        reportRun(&timings, reportPath, tracePath, &info, rank);
+        freeTimings(&timings);
+        return failed ? EXIT_FAILURE : 0;
+    }
+
+    // clouds larger than memory are binned into tiles on disk and filtered tile by tile
+    if (tileSize > 0) {
+        long kept;
+        if (filterType == 'R' && rad >= tileSize) {
+            fprintf(stderr, "Tile size must be larger than the search radius\n");
+            exit(EXIT_FAILURE);
+        }
+        beginPhase(&timings, "tiled");
+        if (!filterTiled(filename, "output.ply", &params, &nvertices, &kept)) {
+            fprintf(stderr, "Failed to filter PLY file %s by tiles\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        endPhase(&timings);
+        printf("File contains %ld points\n", nvertices);
+        printf("Cloud filtered by tiles in %f seconds\n", phaseSeconds(&timings, "tiled"));
+        printf("Finished filtering the cloud! It contains %ld points now\n", kept);
+        info.mode = "tiled";
+        info.points = nvertices;
+        info.kept = kept;
+        reportRun(&timings, reportPath, tracePath, &info, rank);
+        freeTimings(&timings);
+        return 0;
+    }
+#endif
+
+#ifdef USE_MPI
+    // processes of a node share one copy of the cloud and the octree
+    if (shared) {
+        mpiInitNode(MPI_COMM_WORLD, &nodeComm);
+        node = &nodeComm;
+    }
+    // binary files are read in parallel, each process reading its own slice;
+    // ASCII ones are read whole by every process
+    beginPhase(&timings, "load");
+    status = mpiReadPly(MPI_COMM_WORLD, node, filename, &inputpts, &slice);
+    if (status < 0) {
+        if (rank == 0)
+            fprintf(stderr, "Failed to read from PLY file\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    if (status == 0) {
+        readPlyFile(filename, &cloud);
+        nvertices = cloud.size;
+        sliceCloud(MPI_COMM_WORLD, node, nvertices, &slice);
+        inputpts = mpiAllocCloud(node, nvertices);
+        memcpy(inputpts + slice.first, cloud.points + slice.first, sizeof(Point) * slice.count);
+        freePlyCloud(&cloud);
+    }
+    endPhase(&timings);
+    nvertices = slice.total;
+    first = slice.first;
+    count = slice.count;
+#else
+    // a valid octree index of the file is queried in place without any build,
+    // the file itself is only read when the kept points are written
+    testOctree = malloc(sizeof(Octree));
+    initOctree(testOctree);
+    testOctree->ownsPoints = 0;
+    snprintf(indexPath, sizeof(indexPath), "%s.oct", filename);
+    if (useIndex && noiseProb) {
+        fprintf(stderr, "Noised points don't match the octree index, it isn't used\n");
+        useIndex = 0;
+    }
+    if (useIndex && dedup) {
+        fprintf(stderr, "Merged duplicate points don't match the octree index, it isn't used\n");
+        useIndex = 0;
+    }
+    beginPhase(&timings, "load");
+    if (useIndex)
+        indexed = openOctreeIndex(indexPath, filename, tune ? 0 : bucketSize, maxDepth, testOctree, &index);
+    if (indexed) {
+        printf("Octree loaded from index %s, bucket size %d\n", indexPath, testOctree->bucketSize);
+        inputpts = testOctree->points;
+        nvertices = index.npoints;
+    }
+    else {
+        readPlyFile(filename, &cloud);
+        if (cloud.layout.dropped)
+            fprintf(stderr, "%d vertex properties can't be carried to the output and are dropped\n",
+                cloud.layout.dropped);
+        inputpts = cloud.points;
+        nvertices = cloud.size;
+    }
+    endPhase(&timings);
+    first = 0;
+    count = nvertices;
+#endif
+    if (rank == 0)
+        printf("File contains %ld points\n", nvertices);
 
     if (noiseProb) {
         int noiseCounter = 0;
-        for (int i = 0; i < nvertices; i++ ) {   
+        beginPhase(&timings, "noise");
+        for (long i = first; i < first + count; i++ ) {   
             if ((double)rand() / (double)RAND_MAX < noiseProb ) {
                 // Generate gaussian noise
                 inputpts[i].x += AWGN_generator();
@@ -124,47 +385,197 @@ int main(int argc, char* argv[])
                 ++noiseCounter;
             }
         }
-        printf("NOISE_COUNTER = %d\n", noiseCounter);
+        endPhase(&timings);
+#ifdef USE_MPI
+        MPI_Allreduce(MPI_IN_PLACE, &noiseCounter, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        if (rank == 0)
+            printf("NOISE_COUNTER = %d\n", noiseCounter);
+    }
+#ifndef USE_MPI
+    octreePts = inputpts;
+    octreeSize = nvertices;
+    // filters decide once for all copies of a point, the octree holds one of them
+    if (dedup) {
+        beginPhase(&timings, "dedup");
+        dedupCloud(inputpts, nvertices, &copies);
+        endPhase(&timings);
+        printf("%ld unique points\n", (long) copies.size);
+        octreePts = copies.points;
+        octreeSize = copies.size;
+    }
+#endif
+#ifdef USE_MPI
+    beginPhase(&timings, "exchange");
+    mpiAllgatherCloud(MPI_COMM_WORLD, node, inputpts, &slice);
+    endPhase(&timings);
+#endif
+
+    // an indexed octree was tuned when the index was written
+#ifdef USE_MPI
+    if (tune) {
+        beginPhase(&timings, "tune");
+        if (rank == 0)
+            params.bucketSize = tuneBucketSize(inputpts, NULL, nvertices, &params);
+        MPI_Bcast(&params.bucketSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        endPhase(&timings);
+#else
+    if (tune && !indexed) {
+        beginPhase(&timings, "tune");
+        params.bucketSize = tuneBucketSize(octreePts, dedup ? copies.weights : NULL, octreeSize, &params);
+        endPhase(&timings);
+#endif
+        if (rank == 0)
+            printf("Bucket size %d chosen in %f seconds\n", params.bucketSize, phaseSeconds(&timings, "tune"));
     }
 
     // initializing and building an octree from a point cloud
+#ifdef USE_MPI
+    beginPhase(&timings, "build");
     testOctree = malloc(sizeof(Octree));
     initOctree(testOctree);
-    buildOctree(testOctree, inputpts, nvertices);
+    testOctree->ownsPoints = 0; // input points may be mapped or shared, they are released below
+    if (node)
+        mpiShareOctree(node, testOctree, inputpts, nvertices, params.bucketSize, params.maxDepth);
+    else
+        buildOctree(testOctree, inputpts, nvertices, params.bucketSize, params.maxDepth);
+    endPhase(&timings);
+#else
+    if (!indexed) {
+        beginPhase(&timings, "build");
+        testOctree->weights = dedup ? copies.weights : NULL;
+        buildOctree(testOctree, octreePts, octreeSize, params.bucketSize, params.maxDepth);
+        if (useIndex && !saveOctreeIndex(indexPath, filename, testOctree))
+            fprintf(stderr, "Failed to write octree index %s\n", indexPath);
+        endPhase(&timings);
+    }
+#endif
     
+#ifdef USE_MPI
     // array of indexes of points to remain in the cloud
-    indsToStay = malloc(sizeof(int) * nvertices);
+    indsToStay = malloc(sizeof(PointIndex) * count);
+    countAlloc(ALLOC_RESULTS, (long) sizeof(PointIndex) * count);
+#else
+    // mask of points to remain in the cloud, one bit per point
+    keep = allocMask(count);
+    countAlloc(ALLOC_RESULTS, maskWords(count) * sizeof(MaskWord));
+    if (dedup) {
+        uniqueKeep = allocMask(octreeSize);
+        countAlloc(ALLOC_RESULTS, maskWords(octreeSize) * sizeof(MaskWord));
+    }
+#endif
     resultSize = 0;
     
-    printf("Starting filtering...\n\n");
+    if (rank == 0)
+        printf("Starting filtering...\n\n");
     // timed radius outlier filtering
-    gettimeofday(&start, NULL);
+    beginPhase(&timings, "filter");
+#ifdef USE_MPI
     if (filterType == 'R')
-       // RORfilter(Octree *octree, int k, float radius, int size, int *result, long *resultSize) 
-        RORfilter(testOctree, k, rad, nvertices, indsToStay, &resultSize);
+        RORfilterRange(testOctree, k, rad, first, first + count, indsToStay, &resultSize);
     else if (filterType == 'S')
-       // SORfilter(Octree *octree, int size, int meanK, float multiplier, int *result, long *resultSize
-        SORfilter(testOctree, nvertices, k, mul, indsToStay, &resultSize);
-    gettimeofday(&stop, NULL);
-    gettimeofday(&stop, NULL);
-    microseconds = (stop.tv_sec - start.tv_sec) * 1000000 + stop.tv_usec - start.tv_usec;
-    printf("Points to be filtered found in %f seconds\n", (float)microseconds / 1000000);
+        mpiSORfilter(MPI_COMM_WORLD, testOctree, k, mul, &slice, indsToStay, &resultSize);
+#else
+    if (filterType == 'R')
+       // RORfilterMask(Octree *octree, int k, float radius, PointIndex begin, PointIndex end, MaskWord *keep)
+        RORfilterMask(testOctree, k, rad, 0, octreeSize, dedup ? uniqueKeep : keep);
+    else if (filterType == 'S')
+       // SORfilterMask(Octree *octree, PointIndex size, int meanK, float multiplier, MaskWord *keep)
+        SORfilterMask(testOctree, octreeSize, k, mul, dedup ? uniqueKeep : keep);
+    // every copy of a point shares the decision of its unique point
+    if (dedup)
+        expandMask(&copies, uniqueKeep, nvertices, keep);
+    resultSize = countMask(keep, nvertices);
+#endif
+    endPhase(&timings);
+    filterSeconds = phaseSeconds(&timings, "filter");
+#ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &filterSeconds, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    if (rank == 0)
+        printf("Points to be filtered found in %f seconds\n", filterSeconds);
+#ifdef USE_MPI
+    // every process writes its own kept points into the shared output file
+    if (!binary && rank == 0)
+        fprintf(stderr, "ASCII output isn't supported by parallel runs, writing binary\n");
+    beginPhase(&timings, "write");
+    if (!mpiWritePly(MPI_COMM_WORLD, "output.ply", inputpts, indsToStay, resultSize, &resultSize) && rank == 0)
+        fprintf(stderr, "Failed to write output PLY file\n");
+    endPhase(&timings);
+    if (rank == 0) {
+        printf("%ld points to stay\n", resultSize);
+        printf("\nFiltering the cloud...\n");
+        printf("Finished filtering the cloud! It contains %ld points now\n", resultSize);
+    }
+#else
     printf("%ld points to stay\n", resultSize);
 
     printf("\nFiltering the cloud...\n");
-    resultpts = malloc(sizeof(Point) * resultSize);
-    j = 0;
-    for (i = 0; i < resultSize; i++) {
-        resultpts[i] = inputpts[indsToStay[j]];
-        j++;
+    // points of an index are in leaf order, the file is read for writing them
+    if (indexed) {
+        MaskWord *sourceKeep = allocMask(nvertices);
+        countAlloc(ALLOC_RESULTS, maskWords(nvertices) * sizeof(MaskWord));
+        indexToSourceOrder(&index, keep, sourceKeep);
+        free(keep);
+        countFree(ALLOC_RESULTS, maskWords(count) * sizeof(MaskWord));
+        keep = sourceKeep;
+        beginPhase(&timings, "reload");
+        readPlyFile(filename, &cloud);
+        endPhase(&timings);
     }
+    // kept points and their attributes are compacted in place by all threads
+    beginPhase(&timings, "gather");
+    compactMask(keep, cloud.size, (char *) cloud.points, sizeof(Point), (char *) cloud.points);
+    if (cloud.attributes && cloud.layout.nattributes)
+        compactMask(keep, cloud.size, cloud.attributes, cloud.layout.attrStride, cloud.attributes);
+    cloud.size = resultSize;
+    endPhase(&timings);
+    beginPhase(&timings, "write");
+    if (packResolution > 0) {
+        if (!writePacked("output" PACK_EXTENSION, &cloud, NULL, resultSize, packResolution))
+            fprintf(stderr, "Failed to write output container\n");
+    }
+    else if (!writePly("output.ply", &cloud, NULL, resultSize, binary))
+        fprintf(stderr, "Failed to write output PLY file\n");
+    endPhase(&timings);
     printf("Finished filtering the cloud! It contains %ld points now\n", resultSize);
-    writePlyOutput("output.ply", resultpts, resultSize);
+#endif
+
+#ifdef USE_MPI
+    mpiReduceTimings(MPI_COMM_WORLD, &timings);
+    info.mode = "mpi";
+#else
+    info.mode = "serial";
+#endif
+    info.points = nvertices;
+    info.kept = resultSize;
+    takeMemory(&memory);
+    info.memory = &memory;
+    reportRun(&timings, reportPath, tracePath, &info, rank);
+    freeTimings(&timings);
 
     // freeing memory
     deleteOctree(testOctree);
-    free(resultpts);
     free(indsToStay);
+    free(keep);
 
+#ifdef USE_MPI
+    countFree(ALLOC_RESULTS, (long) sizeof(PointIndex) * count);
+    if (node)
+        mpiFreeNode(node);
+    else {
+        free(inputpts);
+        countFree(ALLOC_POINTS, (long) sizeof(Point) * nvertices);
+    }
+    MPI_Finalize();
+#else
+    countFree(ALLOC_RESULTS, maskWords(count) * sizeof(MaskWord));
+    freePlyCloud(&cloud);
+    closeOctreeIndex(&index);
+    free(uniqueKeep);
+    if (dedup)
+        countFree(ALLOC_RESULTS, maskWords(octreeSize) * sizeof(MaskWord));
+    freeDedup(&copies);
+#endif
     return 0;
 }
\ No newline at end of file
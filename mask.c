@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "mask.h"
+
+// zeroed mask of n points
+MaskWord *allocMask(long n)
+{
+    return calloc(maskWords(n) > 0 ? maskWords(n) : 1, sizeof(MaskWord));
+}
+
+// number of set bits among the first n
+long countMask(const MaskWord *mask, long n)
+{
+    long w, count = 0;
+
+    #pragma omp parallel for reduction(+:count)
+    for (w = 0; w < maskWords(n); w++)
+        count += __builtin_popcountl(mask[w]);
+    return count;
+}
+
+// gathers the records of size stride of src whose bits are set into dst, in
+// order, and returns their number. Every thread counts the bits of its range of
+// words, prefix sums of the counts give where its records go. With dst == src
+// the records are compacted in place: each thread first packs them at the
+// start of its own range, the packed ranges are then moved down one by one
+long compactMask(const MaskWord *mask, long n, const char *src, size_t stride, char *dst)
+{
+    long nwords = maskWords(n), *offsets, total;
+    int inPlace = dst == src, nthreads = omp_get_max_threads(), t;
+
+    offsets = calloc(nthreads + 1, sizeof(long));
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int nt = omp_get_num_threads(), id = omp_get_thread_num(), i;
+        long begin = nwords * id / nt, end = nwords * (id + 1) / nt, w, count = 0;
+        MaskWord bits;
+        char *out;
+
+        for (w = begin; w < end; w++)
+            count += __builtin_popcountl(mask[w]);
+        offsets[id + 1] = count;
+        #pragma omp barrier
+        #pragma omp single
+        {
+            nthreads = nt;
+            for (i = 0; i < nt; i++)
+                offsets[i + 1] += offsets[i];
+        }
+
+        out = inPlace ? dst + (size_t) begin * MASK_BITS * stride : dst + (size_t) offsets[id] * stride;
+        for (w = begin; w < end; w++) {
+            for (bits = mask[w]; bits; bits &= bits - 1) {
+                // records only move down, memmove covers a record copied onto itself
+                memmove(out, src + (size_t) (w * MASK_BITS + __builtin_ctzl(bits)) * stride, stride);
+                out += stride;
+            }
+        }
+    }
+    if (inPlace)
+        for (t = 1; t < nthreads; t++)
+            memmove(dst + (size_t) offsets[t] * stride, dst + (size_t) (nwords * t / nthreads) * MASK_BITS * stride,
+                (size_t) (offsets[t + 1] - offsets[t]) * stride);
+    total = offsets[nthreads];
+    free(offsets);
+    return total;
+}
+
+// indexes first + i of the set bits i, in increasing order. Returns their number
+long maskToIndexes(const MaskWord *mask, long n, PointIndex first, PointIndex *inds)
+{
+    long w, count = 0;
+    MaskWord bits;
+
+    for (w = 0; w < maskWords(n); w++)
+        for (bits = mask[w]; bits; bits &= bits - 1)
+            inds[count++] = first + w * MASK_BITS + __builtin_ctzl(bits);
+    return count;
+}
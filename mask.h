@@ -0,0 +1,18 @@
+#ifndef MASK_H
+#define MASK_H
+
+#include <stddef.h>
+#include "my_octree.h"
+
+// operations on keep-masks of filter results (MaskWord in my_octree.h) and
+// their parallel compaction into kept points or attribute records
+
+#define testMask(mask, i) (((mask)[(i) / MASK_BITS] >> ((i) % MASK_BITS)) & 1)
+#define setMask(mask, i) ((mask)[(i) / MASK_BITS] |= 1UL << ((i) % MASK_BITS))
+
+MaskWord *allocMask(long);
+long countMask(const MaskWord *, long);
+long compactMask(const MaskWord *, long, const char *, size_t, char *);
+long maskToIndexes(const MaskWord *, long, PointIndex, PointIndex *);
+
+#endif
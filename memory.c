@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "memory.h"
+#include "alloc.h"
+#include "pack.h"
+#include "dedup.h"
+
+// octants buildOctree makes of n points, estimated without reading them. On
+// the clouds of the benchmark and the test scans a bucket of points takes
+// from about 1.5 octants for buckets of 1 point to 6 for buckets of 256, about
+// 0.6 more for every doubling of the bucket size, as the splits of smaller
+// buckets leave fewer sparse children. A tree of maxDepth levels can't have
+// more octants than these levels hold
+static long estimateOctants(long n, int bucketSize, int maxDepth)
+{
+    double perBucket = 1.5, octants, level = 1.0, levels = 1.0;
+    int b, depth;
+
+    for (b = bucketSize; b > 1; b /= 2)
+        perBucket += 0.6;
+    octants = perBucket * n / bucketSize + 1.0;
+    for (depth = 1; maxDepth && depth <= maxDepth && levels < octants; depth++) {
+        level *= 8.0;
+        levels += level;
+    }
+    if (maxDepth && levels < octants)
+        octants = levels;
+    return (long) octants;
+}
+
+// bytes of the octant array of a tree of noctants, which grows by doubling from 64
+static long octantBytes(long noctants)
+{
+    long capacity = 64;
+
+    while (capacity < noctants)
+        capacity *= 2;
+    return capacity * sizeof(Octant);
+}
+
+// most bytes every kind of buffer has held since the start of the process
+void takeMemory(MemoryUsage *usage)
+{
+    long peaks[ALLOC_KINDS];
+
+    allocPeaks(peaks, &usage->total);
+    usage->points = peaks[ALLOC_POINTS];
+    usage->attributes = peaks[ALLOC_ATTRIBUTES];
+    usage->successors = peaks[ALLOC_SUCCESSORS];
+    usage->octants = peaks[ALLOC_OCTANTS];
+    usage->workspaces = peaks[ALLOC_WORKSPACES];
+    usage->results = peaks[ALLOC_RESULTS];
+    usage->output = peaks[ALLOC_OUTPUT];
+    usage->dedup = peaks[ALLOC_DEDUP];
+}
+
+// memory the first process of a run on a file will allocate, following the
+// allocations of its path. Kept points are bounded by all points and unique
+// ones of a deduplicated cloud too. *npoints is set to the points of the file.
+// Returns 0 if the header of the file can't be read
+int predictMemory(const char *filename, const FilterParams *params, const RunShape *shape, long *npoints,
+    MemoryUsage *usage)
+{
+    PlyLayout layout;
+    long n, count, noctants;
+    int packed = isPackedFile(filename), attributes;
+
+    if (!(packed ? readPackedLayout(filename, &layout, &count) : readPlyLayout(filename, &layout)))
+        return 0;
+    n = *npoints = layout.nvertices;
+    noctants = estimateOctants(n, params->bucketSize, params->maxDepth);
+    memset(usage, 0, sizeof(MemoryUsage));
+    usage->successors = n * sizeof(PointIndex);
+    usage->octants = octantBytes(noctants);
+    usage->workspaces = (long) shape->nthreads * params->k * (sizeof(Point) + sizeof(float));
+
+    if (shape->nprocs > 0) {
+        // the whole cloud, without attributes, is read in parallel. Files which
+        // can't be read this way are read whole first and copied
+        attributes = packed || layout.offset < 0;
+        usage->points = (attributes ? 2 : 1) * n * sizeof(Point);
+        usage->attributes = attributes && layout.nattributes ? n * layout.attrStride : 0;
+        // a shared octree is copied into a window of the node
+        if (shape->shared) {
+            usage->successors *= 2;
+            usage->octants += noctants * sizeof(Octant);
+        }
+        // kept indexes of the own slice, with its mask or mean distances, and
+        // the kept points gathered for writing
+        count = n / shape->nprocs;
+        usage->results = count * sizeof(PointIndex) +
+            (params->filterType == 'S' ? count * sizeof(float) : maskWords(count) * sizeof(MaskWord));
+        usage->output = count * sizeof(Point);
+    }
+    else {
+        usage->points = n * sizeof(Point);
+        usage->attributes = layout.nattributes ? n * layout.attrStride : 0;
+        usage->results = (shape->dedup ? 2 : 1) * maskWords(n) * sizeof(MaskWord);
+        if (params->filterType == 'S')
+            usage->results += n * sizeof(float);
+        usage->output = shape->packed ? packedWriterBytes(n, &layout) : plyWriterBytes(params->binary, &layout);
+        usage->dedup = shape->dedup ? dedupBytes(n) : 0;
+    }
+    usage->total = usage->points + usage->attributes + usage->successors + usage->octants +
+        usage->workspaces + usage->results + usage->output + usage->dedup;
+    return 1;
+}
+
+void printMemory(const char *title, const MemoryUsage *usage)
+{
+    printf("\n%s, MB:\n", title);
+    printf("  points      %12.2f\n", usage->points / 1048576.0);
+    printf("  attributes  %12.2f\n", usage->attributes / 1048576.0);
+    printf("  successors  %12.2f\n", usage->successors / 1048576.0);
+    printf("  octants     %12.2f\n", usage->octants / 1048576.0);
+    printf("  workspaces  %12.2f\n", usage->workspaces / 1048576.0);
+    printf("  results     %12.2f\n", usage->results / 1048576.0);
+    printf("  output      %12.2f\n", usage->output / 1048576.0);
+    printf("  dedup       %12.2f\n", usage->dedup / 1048576.0);
+    printf("  total       %12.2f\n", usage->total / 1048576.0);
+}
+
+// peak resident set size of the process in bytes
+long peakRss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return usage.ru_maxrss * 1024L;
+}
@@ -0,0 +1,39 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "ply_io.h"
+
+// bytes held by the buffers of a filtering run. A finished run reports the most
+// bytes every kind of buffer has held, as counted where the buffers are
+// allocated and released (alloc.h), and the most held by all of them at once.
+// A predicted run adds up what its path will allocate for the points in the
+// header of a file, with the octants of its octree estimated
+
+typedef struct MemoryUsage {
+    long points;        // point buffer
+    long attributes;    // attribute records of the points
+    long successors;
+    long octants;
+    long workspaces;    // neighbor and distance lists of the querying threads
+    long results;       // keep-masks, kept indexes and SOR mean distances
+    long output;        // buffers of the writer
+    long dedup;         // merged copies of points
+    long total;
+} MemoryUsage;
+
+// what a predicted run does besides building its octree and filtering
+typedef struct RunShape {
+    int nthreads;
+    int nprocs;         // processes of a parallel run, 0 for a serial one
+    int shared;         // parallel run sharing the cloud and the octree per node
+    int dedup;          // serial run merging copies of points
+    int packed;         // serial run writing a container
+} RunShape;
+
+void takeMemory(MemoryUsage *);
+int predictMemory(const char *, const FilterParams *, const RunShape *, long *, MemoryUsage *);
+void printMemory(const char *, const MemoryUsage *);
+
+long peakRss();
+
+#endif
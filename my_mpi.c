@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "my_mpi.h"
+#include "ply_io.h"
+#include "trace.h"
+#include "alloc.h"
+
+#define MPI_IO_CHUNK (64L * 1024 * 1024) // max bytes read or written by one collective call
+
+// MPI datatype of a Point
+static MPI_Datatype pointType(void)
+{
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(3, MPI_FLOAT, &type);
+        MPI_Type_commit(&type);
+    }
+    return type;
+}
+
+// slice of a cloud of total points owned by process rank out of nprocs
+static void sliceOf(long total, int rank, int nprocs, CloudSlice *slice)
+{
+    slice->total = total;
+    slice->first = total * rank / nprocs;
+    slice->count = total * (rank + 1) / nprocs - slice->first;
+}
+
+// splitting the processes of comm by nodes
+void mpiInitNode(MPI_Comm comm, NodeComm *node)
+{
+    int rank;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node->comm);
+    MPI_Comm_rank(node->comm, &node->rank);
+    MPI_Comm_split(comm, node->rank == 0 ? 0 : MPI_UNDEFINED, rank, &node->leaders);
+    if (node->rank == 0) {
+        MPI_Comm_rank(node->leaders, &node->index);
+        MPI_Comm_size(node->leaders, &node->nnodes);
+    }
+    MPI_Bcast(&node->index, 1, MPI_INT, 0, node->comm);
+    MPI_Bcast(&node->nnodes, 1, MPI_INT, 0, node->comm);
+    node->cloudWin = MPI_WIN_NULL;
+    node->treeWin = MPI_WIN_NULL;
+    node->cloudBytes = 0;
+    node->successorsBytes = 0;
+    node->octantsBytes = 0;
+}
+
+// freeing shared windows and communicators of a node
+void mpiFreeNode(NodeComm *node)
+{
+    if (node->treeWin != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(node->treeWin);
+        MPI_Win_free(&node->treeWin);
+        countFree(ALLOC_SUCCESSORS, node->successorsBytes);
+        countFree(ALLOC_OCTANTS, node->octantsBytes);
+    }
+    if (node->cloudWin != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(node->cloudWin);
+        MPI_Win_free(&node->cloudWin);
+        countFree(ALLOC_POINTS, node->cloudBytes);
+    }
+    if (node->leaders != MPI_COMM_NULL)
+        MPI_Comm_free(&node->leaders);
+    MPI_Comm_free(&node->comm);
+}
+
+// making stores to a shared window visible to all processes of the node
+static void nodeSync(NodeComm *node, MPI_Win win)
+{
+    MPI_Win_sync(win);
+    MPI_Barrier(node->comm);
+    MPI_Win_sync(win);
+}
+
+// allocating a window shared by the node, only its first process provides memory
+static void* allocShared(NodeComm *node, long size, MPI_Win *win)
+{
+    MPI_Aint sharedSize;
+    int dispUnit;
+    void *base;
+
+    MPI_Win_allocate_shared(node->rank == 0 ? size : 0, 1, MPI_INFO_NULL, node->comm, &base, win);
+    MPI_Win_shared_query(*win, 0, &sharedSize, &dispUnit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+    return base;
+}
+
+// splitting a cloud into equal contiguous slices, per node first if node is given
+void sliceCloud(MPI_Comm comm, NodeComm *node, long total, CloudSlice *slice)
+{
+    CloudSlice nodeSlice;
+    int rank, nprocs;
+
+    if (!node) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &nprocs);
+        sliceOf(total, rank, nprocs, slice);
+        return;
+    }
+    MPI_Comm_size(node->comm, &nprocs);
+    sliceOf(total, node->index, node->nnodes, &nodeSlice);
+    sliceOf(nodeSlice.count, node->rank, nprocs, slice);
+    slice->first += nodeSlice.first;
+    slice->total = total;
+}
+
+// allocating memory for the whole cloud, shared by the node if node is given
+Point* mpiAllocCloud(NodeComm *node, long total)
+{
+    if (!node) {
+        countAlloc(ALLOC_POINTS, (long) sizeof(Point) * total);
+        return malloc(sizeof(Point) * total);
+    }
+    node->cloudBytes = node->rank == 0 ? (long) sizeof(Point) * total : 0;
+    countAlloc(ALLOC_POINTS, node->cloudBytes);
+    return allocShared(node, sizeof(Point) * total, &node->cloudWin);
+}
+
+// parallel reading of a binary PLY file: rank 0 parses the header, then every
+// process reads its own slice of the vertex records with collective MPI-IO.
+// *pts is allocated for the whole cloud, only the own slice of it is filled.
+// Returns 1 on success, 0 for files that can't be read this way (ASCII,
+// variable-size records) and -1 on read errors
+int mpiReadPly(MPI_Comm comm, NodeComm *node, const char *filename, Point **pts, CloudSlice *slice)
+{
+    PlyLayout layout;
+    MPI_File file;
+    MPI_Status status;
+    MPI_Offset offset;
+    char *raw;
+    long chunk, done, n;
+    int rank, ok = 0, rounds, round;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+        ok = readPlyLayout(filename, &layout) && layout.offset >= 0;
+    MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+    if (!ok)
+        return 0;
+    MPI_Bcast(&layout, sizeof(PlyLayout), MPI_BYTE, 0, comm);
+
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        return -1;
+    sliceCloud(comm, node, layout.nvertices, slice);
+    *pts = mpiAllocCloud(node, slice->total);
+
+    // all processes have to take part in every collective read
+    chunk = MPI_IO_CHUNK / layout.stride;
+    if (chunk < 1)
+        chunk = 1;
+    rounds = (slice->count + chunk - 1) / chunk;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_INT, MPI_MAX, comm);
+    raw = malloc(chunk * layout.stride);
+
+    done = 0;
+    for (round = 0; round < rounds; round++) {
+        n = slice->count - done;
+        if (n > chunk)
+            n = chunk;
+        offset = (MPI_Offset) layout.offset + (MPI_Offset) (slice->first + done) * layout.stride;
+        if (MPI_File_read_at_all(file, offset, raw, (int) (n * layout.stride), MPI_BYTE, &status) != MPI_SUCCESS)
+            ok = 0;
+        decodeVertices(&layout, raw, n, *pts + slice->first + done);
+        done += n;
+    }
+    free(raw);
+    MPI_File_close(&file);
+
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+    return ok ? 1 : -1;
+}
+
+// broadcasting every slice from its process in chunks, for clouds whose
+// offsets don't fit the int displacements of MPI_Allgatherv
+static void bcastSlices(MPI_Comm comm, Point *pts, long total)
+{
+    CloudSlice other;
+    long chunk = MPI_IO_CHUNK / sizeof(Point), done, n;
+    int i, nprocs;
+
+    MPI_Comm_size(comm, &nprocs);
+    for (i = 0; i < nprocs; i++) {
+        sliceOf(total, i, nprocs, &other);
+        for (done = 0; done < other.count; done += n) {
+            n = other.count - done;
+            if (n > chunk)
+                n = chunk;
+            MPI_Bcast(pts + other.first + done, (int) n, pointType(), i, comm);
+        }
+    }
+}
+
+// collecting all slices so that every process (or every node) holds the whole cloud
+void mpiAllgatherCloud(MPI_Comm comm, NodeComm *node, Point *pts, const CloudSlice *slice)
+{
+    CloudSlice other;
+    int *counts, *displs;
+    int i, nprocs;
+    double span;
+
+    // with shared memory slices of a node are already in place, nodes exchange their ranges
+    if (node) {
+        nodeSync(node, node->cloudWin);
+        if (node->leaders == MPI_COMM_NULL) {
+            nodeSync(node, node->cloudWin);
+            return;
+        }
+        comm = node->leaders;
+    }
+
+    span = traceBegin();
+    if (slice->total > INT_MAX)
+        bcastSlices(comm, pts, slice->total);
+    else {
+        MPI_Comm_size(comm, &nprocs);
+        counts = malloc(sizeof(int) * nprocs);
+        displs = malloc(sizeof(int) * nprocs);
+        for (i = 0; i < nprocs; i++) {
+            sliceOf(slice->total, i, nprocs, &other);
+            counts[i] = other.count;
+            displs[i] = other.first;
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, pts, counts, displs, pointType(), comm);
+        free(counts);
+        free(displs);
+    }
+    traceEnd("allgather", span);
+
+    if (node)
+        nodeSync(node, node->cloudWin);
+}
+
+// building the octree once per node: the first process of the node builds it and
+// moves successors and octants into a shared window, the others attach to it
+void mpiShareOctree(NodeComm *node, Octree *octree, Point *pts, long total, int bucketSize, int maxDepth)
+{
+    char *base;
+    int noctants = 0;
+
+    if (node->rank == 0) {
+        buildOctree(octree, pts, total, bucketSize, maxDepth);
+        noctants = octree->noctants;
+    }
+    MPI_Bcast(&noctants, 1, MPI_INT, 0, node->comm);
+
+    base = allocShared(node, sizeof(PointIndex) * total + sizeof(Octant) * noctants, &node->treeWin);
+    if (node->rank == 0) {
+        node->successorsBytes = (long) sizeof(PointIndex) * total;
+        node->octantsBytes = (long) sizeof(Octant) * noctants;
+        countAlloc(ALLOC_SUCCESSORS, node->successorsBytes);
+        countAlloc(ALLOC_OCTANTS, node->octantsBytes);
+        memcpy(base, octree->successors, sizeof(PointIndex) * total);
+        memcpy(base + sizeof(PointIndex) * total, octree->octants, sizeof(Octant) * noctants);
+        free(octree->successors);
+        free(octree->octants);
+        countFree(ALLOC_SUCCESSORS, (long) sizeof(PointIndex) * octree->successorsCapacity);
+        countFree(ALLOC_OCTANTS, (long) sizeof(Octant) * octree->capacity);
+    }
+    octree->points = pts;
+    octree->bucketSize = bucketSize;
+    octree->maxDepth = maxDepth;
+    octree->successors = (PointIndex *) base;
+    octree->octants = (Octant *) (base + sizeof(PointIndex) * total);
+    octree->noctants = noctants;
+    octree->capacity = noctants;
+    octree->successorsCapacity = total;
+    octree->shared = 1;
+    nodeSync(node, node->treeWin);
+}
+
+// SOR filtering of the own slice with the statistics of the whole cloud
+void mpiSORfilter(MPI_Comm comm, Octree *octree, int meanK, float multiplier, const CloudSlice *slice, PointIndex *result, long *resultSize)
+{
+    float *meanDists = malloc(sizeof(float) * slice->count);
+    double sums[2] = { 0.0, 0.0 };
+    double span;
+
+    countAlloc(ALLOC_RESULTS, (long) sizeof(float) * slice->count);
+    SORmeanDists(octree, meanK, slice->first, slice->first + slice->count, meanDists);
+    SORaddSums(meanDists, NULL, slice->count, sums);
+    span = traceBegin();
+    MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, comm);
+    traceEnd("reduce statistics", span);
+
+    SORselect(meanDists, slice->first, slice->first + slice->count,
+        SORsumsThreshold(sums, slice->total, multiplier), result, resultSize);
+    free(meanDists);
+    countFree(ALLOC_RESULTS, (long) sizeof(float) * slice->count);
+}
+
+// collective writing of the points with given indexes of all processes into one
+// binary PLY file. Each process places its records after those of lower ranks,
+// rank 0 fills the fixed-length header once the total count is known.
+// Returns 1 on success, *total is set to the number of written points
+int mpiWritePly(MPI_Comm comm, const char *filename, Point *pts, PointIndex *inds, long size, long *total)
+{
+    MPI_File file;
+    MPI_Status status;
+    MPI_Offset offset;
+    Point *local;
+    char header[PLY_HEADER_MAX];
+    long first = 0, chunk, done, n, i;
+    int rank, ok = 1, headerSize, rounds, round;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan(&size, &first, 1, MPI_LONG, MPI_SUM, comm);
+    if (rank == 0)
+        first = 0;
+    MPI_Allreduce(&size, total, 1, MPI_LONG, MPI_SUM, comm);
+
+    if (MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        return 0;
+    MPI_File_set_size(file, 0);
+    headerSize = formatPlyHeader(header, *total, 1, NULL);
+
+    local = malloc(sizeof(Point) * (size > 0 ? size : 1));
+    countAlloc(ALLOC_OUTPUT, (long) sizeof(Point) * size);
+    for (i = 0; i < size; i++)
+        local[i] = pts[inds[i]];
+
+    chunk = MPI_IO_CHUNK / sizeof(Point);
+    rounds = (size + chunk - 1) / chunk;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_INT, MPI_MAX, comm);
+
+    done = 0;
+    for (round = 0; round < rounds; round++) {
+        n = size - done;
+        if (n > chunk)
+            n = chunk;
+        offset = headerSize + (MPI_Offset) (first + done) * sizeof(Point);
+        if (MPI_File_write_at_all(file, offset, local + done, (int) (n * sizeof(Point)), MPI_BYTE, &status) != MPI_SUCCESS)
+            ok = 0;
+        done += n;
+    }
+    if (rank == 0 && MPI_File_write_at(file, 0, header, headerSize, MPI_BYTE, &status) != MPI_SUCCESS)
+        ok = 0;
+    free(local);
+    countFree(ALLOC_OUTPUT, (long) sizeof(Point) * size);
+    MPI_File_close(&file);
+
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+    return ok;
+}
+
+// phase timings of all processes, which run the same phases: wall times and peak
+// RSS of the largest process, CPU times summed over processes (per thread number
+// for threads)
+void mpiReduceTimings(MPI_Comm comm, Timings *timings)
+{
+    int p, nthreads = timings->nthreads;
+    double span = traceBegin();
+
+    MPI_Allreduce(MPI_IN_PLACE, &nthreads, 1, MPI_INT, MPI_MIN, comm);
+    MPI_Comm_size(comm, &timings->ranks);
+    for (p = 0; p < timings->nphases; p++) {
+        Phase *phase = &timings->phases[p];
+        MPI_Allreduce(MPI_IN_PLACE, &phase->wall, 1, MPI_DOUBLE, MPI_MAX, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &phase->cpu, 1, MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, phase->threadCpu, nthreads, MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &phase->peakRss, 1, MPI_LONG, MPI_MAX, comm);
+    }
+    timings->nthreads = nthreads;
+    traceEnd("reduce timings", span);
+}
+
+// spans of all processes gathered by rank 0 into one trace file, one process
+// of the trace per rank. Returns 1 on success on every process
+int mpiWriteTrace(MPI_Comm comm, const char *path)
+{
+    long length;
+    char *events = formatTrace(&length), *all = NULL;
+    int *counts = NULL, *displs = NULL;
+    int rank, nprocs, count = length, total = 0, ok = 1, i;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nprocs);
+    if (rank == 0) {
+        counts = malloc(sizeof(int) * nprocs);
+        displs = malloc(sizeof(int) * nprocs);
+    }
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        for (i = 0; i < nprocs; i++) {
+            displs[i] = total;
+            total += counts[i];
+        }
+        all = malloc(total > 0 ? total : 1);
+    }
+    MPI_Gatherv(events, count, MPI_CHAR, all, counts, displs, MPI_CHAR, 0, comm);
+    if (rank == 0)
+        ok = writeTrace(path, all, total);
+    MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+
+    free(events);
+    free(all);
+    free(counts);
+    free(displs);
+    return ok;
+}
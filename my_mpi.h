@@ -0,0 +1,56 @@
+#ifndef MY_MPI_H
+#define MY_MPI_H
+
+#include <mpi.h>
+
+#include "my_octree.h"
+#include "timing.h"
+
+// every process holds the whole cloud, but reads, noises and filters only
+// its own contiguous slice of it: points with indexes in [first, first + count)
+
+typedef struct CloudSlice {
+    long total;
+    long first;
+    long count;
+} CloudSlice;
+
+// processes of one node can keep a single read-only copy of the cloud and of the
+// octree in MPI-3 shared memory windows instead of a copy per process. Slices of
+// the processes of a node are then contiguous so that nodes exchange whole ranges
+
+typedef struct NodeComm {
+    MPI_Comm comm;     // processes of the node
+    MPI_Comm leaders;  // first processes of all nodes, MPI_COMM_NULL on the others
+    int rank;          // rank inside the node
+    int index;         // index of the node
+    int nnodes;
+    MPI_Win cloudWin;
+    MPI_Win treeWin;
+    long cloudBytes;   // provided to the windows by this process
+    long successorsBytes, octantsBytes;
+} NodeComm;
+
+void mpiInitNode(MPI_Comm, NodeComm *);
+void mpiFreeNode(NodeComm *);
+
+// the NodeComm arguments below are NULL when every process keeps its own copy
+
+void sliceCloud(MPI_Comm, NodeComm *, long, CloudSlice *);
+Point* mpiAllocCloud(NodeComm *, long);
+
+// parallel reading and exchanging of the cloud
+
+int mpiReadPly(MPI_Comm, NodeComm *, const char *, Point **, CloudSlice *);
+void mpiAllgatherCloud(MPI_Comm, NodeComm *, Point *, const CloudSlice *);
+void mpiShareOctree(NodeComm *, Octree *, Point *, long, int, int);
+
+// distributed filtering and collecting of the results
+
+void mpiSORfilter(MPI_Comm, Octree *, int, float, const CloudSlice *, PointIndex *, long *);
+int mpiWritePly(MPI_Comm, const char *, Point *, PointIndex *, long, long *);
+
+void mpiReduceTimings(MPI_Comm, Timings *);
+int mpiWriteTrace(MPI_Comm, const char *);
+
+#endif
@@ -5,6 +5,14 @@
 #include <float.h>
 
 #include "my_octree.h"
+#include "mask.h"
+#include "trace.h"
+#include "alloc.h"
+
+#define FILTER_CHUNK 64 // points handed to a thread at once
+#define PI 3.1415926536
+
+Point *inputpts;
 
 // square distance between points
 float sqrDist(Point a, Point b)
@@ -29,63 +37,70 @@ int floatComp(const void * a, const void * b)
   return (fa > fb) - (fa < fb);
 }
 
-// comparator of 2 points by their square distance from point p
-int pointComp(const void* a, const void* b)
-{
-    const Point *l = (const Point *) a;
-    const Point *r = (const Point *) b;
-    return sqrDist(p, *l) > sqrDist(p, *r);
-}
-
-// comparator of 2 octants by square distance of their centers to point p
-int octantComp(const void* a, const void * b)
-{
-    Octant *l = *(Octant **) a;
-    Octant *r = *(Octant **) b;
-    Point lCenter = l->center;
-    Point rCenter = r->center;
-    return sqrDist(p, lCenter) > sqrDist(p, rCenter);
-}
-
 // Octree "constructor"
 void initOctree(Octree *octree)
 {
-    octree->root = NULL;
+    octree->octants = NULL;
+    octree->noctants = 0;
+    octree->capacity = 0;
     octree->points = NULL;
     octree->successors = NULL;
+    octree->successorsCapacity = 0;
+    octree->ownsPoints = 1;
+    octree->shared = 0;
+    octree->bucketSize = BUCKET_SIZE;
+    octree->maxDepth = MAX_DEPTH;
+    octree->weights = NULL;
 }
 
 // Octree "destructor"
 void deleteOctree(Octree *octree)
 {
     if (octree) {
-        if (octree->points) {
-            free(octree->points);
-            octree->points = NULL;
-        }
-        if (octree->successors) {
-            free(octree->successors);
-            octree->successors = NULL;
-        }
-        if (octree->root) {
-            deleteOctant(octree->root);
-            octree->root = NULL;
-        }
+        clearOctree(octree);
         free(octree);
         octree = NULL;
     }
 }
 
-// building an octree
-void buildOctree(Octree *octree, Point *pts, int size)
+// taking count contiguous new octants from the octree's octant array, returns the index of the first one
+static int allocOctants(Octree *octree, int count)
+{
+    int first = octree->noctants, i;
+
+    if (octree->noctants + count > octree->capacity) {
+        countFree(ALLOC_OCTANTS, (long) sizeof(Octant) * octree->capacity);
+        while (octree->noctants + count > octree->capacity)
+            octree->capacity = octree->capacity ? 2 * octree->capacity : 64;
+        octree->octants = realloc(octree->octants, sizeof(Octant) * octree->capacity);
+        countAlloc(ALLOC_OCTANTS, (long) sizeof(Octant) * octree->capacity);
+    }
+    for (i = 0; i < count; i++)
+        initOctant(&octree->octants[first + i]);
+    octree->noctants += count;
+    return first;
+}
+
+// building an octree whose leaves hold at most bucketSize points, unless they
+// are maxDepth levels below the root (0 for no limit) or can't be split any more
+void buildOctree(Octree *octree, Point *pts, PointIndex size, int bucketSize, int maxDepth)
 {
     float min[3], max[3], ctr[3];
     float maxext, ext;
-    int i = 0;
+    PointIndex i = 0;
 
-    clearOctree(octree);
+    // octants and successors of a previous build are reused
+    resetOctree(octree);
     octree->points = pts;
-    octree->successors = malloc(sizeof(int) * size);
+    octree->bucketSize = bucketSize;
+    octree->maxDepth = maxDepth;
+    if (size > octree->successorsCapacity) {
+        countFree(ALLOC_SUCCESSORS, (long) sizeof(PointIndex) * octree->successorsCapacity);
+        free(octree->successors);
+        octree->successors = malloc(sizeof(PointIndex) * size);
+        octree->successorsCapacity = size;
+        countAlloc(ALLOC_SUCCESSORS, (long) sizeof(PointIndex) * size);
+    }
 
     // bounding box
     min[0] = pts[0].x;
@@ -117,79 +132,111 @@ void buildOctree(Octree *octree, Point *pts, int size)
         if (ext > maxext) maxext = ext;
     }
 
-    // recursively creating all octants
-    octree->root = createOctant(octree, size, ctr[0], ctr[1], ctr[2], maxext, 0, size - 1);
+    // recursively creating all octants, the root gets index 0
+    createOctant(octree, allocOctants(octree, 1), size, ctr[0], ctr[1], ctr[2], maxext, 0, size - 1, 0);
 }
 
 // freeing octree
 void clearOctree(Octree *octree)
 {
-    if (octree->points) {
-        free(octree->points);
-        octree->points = NULL;
-    }
-    if (octree->successors) {
+    if (!octree->shared) {
+        if (octree->ownsPoints)
+            free(octree->points);
         free(octree->successors);
-        octree->successors = NULL;
+        free(octree->octants);
+        countFree(ALLOC_SUCCESSORS, (long) sizeof(PointIndex) * octree->successorsCapacity);
+        countFree(ALLOC_OCTANTS, (long) sizeof(Octant) * octree->capacity);
     }
-    if (octree->root) {
-        deleteOctant(octree->root);
-        octree->root = NULL;
+    octree->points = NULL;
+    octree->successors = NULL;
+    octree->successorsCapacity = 0;
+    octree->octants = NULL;
+    octree->noctants = 0;
+    octree->capacity = 0;
+    octree->shared = 0;
+}
+
+// emptying octree but keeping its octant and successor arrays for the next build
+void resetOctree(Octree *octree)
+{
+    if (octree->shared) {
+        clearOctree(octree);
+        return;
     }
+    if (octree->ownsPoints)
+        free(octree->points);
+    octree->points = NULL;
+    octree->noctants = 0;
 }
 
 // Octant "constructor"
 void initOctant(Octant *octant)
 {
-    octant->isLeaf = 1;
-    octant->center.x = 0.0f;
-    octant->center.y = 0.0f;
-    octant->center.z = 0.0f;
-    octant->extent = 0.0f;
+    memset(&octant->lo, 0, sizeof(Point));
+    octant->hi = octant->lo;
     octant->size = 0;
     octant->begin = 0;
     octant->end = 0;
-    memset(&(octant->children), 0, 8 * sizeof(Octant*));
+    octant->firstChild = -1;
+    octant->childMask = 0;
 }
 
-// Octant "destructor"
-void deleteOctant(Octant *octant)
+// are the count points of a chain starting at begin all the same point?
+static int samePoints(const Octree *octree, PointIndex begin, PointIndex count)
 {
-    int i = 0;
-    if (octant) {
-        for (i = 0; i < 8; i++) {
-            if (octant->children[i]) { 
-                deleteOctant(octant->children[i]);
-            }
-        }
-        free(octant);
-        octant = NULL;
+    Point first = octree->points[begin], p;
+    PointIndex index = begin, i;
+
+    for (i = 0; i < count; i++) {
+        p = octree->points[index];
+        if (p.x != first.x || p.y != first.y || p.z != first.z)
+            return 0;
+        index = octree->successors[index];
     }
+    return 1;
 }
 
-// recursive octant creation
-Octant* createOctant(Octree *octree, int sz, float x, float y, float z, float ext, int beginInd, int endInd)
+// tight bounding box of the count points of a chain starting at begin
+static void chainBox(const Octree *octree, PointIndex begin, PointIndex count, Point *lo, Point *hi)
 {
-    int i = 0, index, code, first, lastChildInd;
-    int childrenBegins[8];
-    int childrenEnds[8];
-    int childrenSizes[8];
+    PointIndex index = begin, i;
+    Point p;
+
+    *lo = *hi = octree->points[begin];
+    for (i = 1; i < count; i++) {
+        index = octree->successors[index];
+        p = octree->points[index];
+        lo->x = fminf(lo->x, p.x);
+        lo->y = fminf(lo->y, p.y);
+        lo->z = fminf(lo->z, p.z);
+        hi->x = fmaxf(hi->x, p.x);
+        hi->y = fmaxf(hi->y, p.y);
+        hi->z = fmaxf(hi->z, p.z);
+    }
+}
+
+// recursive creation of the octant at index octInd, a depth below the root.
+// Children of an octant are taken together so that siblings are contiguous
+void createOctant(Octree *octree, int octInd, PointIndex sz, float x, float y, float z, float ext, PointIndex beginInd, PointIndex endInd, int depth)
+{
+    int i = 0, c, code, lastChildInd;
+    PointIndex j, index;
+    PointIndex childrenBegins[8];
+    PointIndex childrenEnds[8];
+    PointIndex childrenSizes[8];
     float childExt, childX, childY, childZ;
     static const float factor[] = { -0.5f, 0.5f };
     Point *pts = NULL;
+    Octant *oct, *child;
+    unsigned char mask = 0;
 
-    Octant *oct = malloc(sizeof(Octant));
-    initOctant(oct);
+    // octant array may be moved by children creation, so octants are accessed by index
+    oct = &octree->octants[octInd];
     oct->size = sz;
-    oct->center.x = x;
-    oct->center.y = y;
-    oct->center.z = z;
-    oct->extent = ext;
     oct->begin = beginInd;
     oct->end = endInd;
 
-    if (sz > BUCKET_SIZE && ext > 0) { // not a leaf yet
-        oct->isLeaf = 0;
+    if (sz > octree->bucketSize && ext > 0 && (!octree->maxDepth || depth < octree->maxDepth)) { // not a leaf yet
         pts = octree->points;
 
         for (i = 0; i < 8; i++) {
@@ -199,7 +246,7 @@ Octant* createOctant(Octree *octree, int sz, float x, float y, float z, float ex
         }
         index = beginInd;
 
-        for (i = 0; i < sz; i++) {
+        for (j = 0; j < sz; j++) {
             code = 0;
             // which child octant does the point belong to
             if (pts[index].x > x) code |= 1;
@@ -208,6 +255,7 @@ Octant* createOctant(Octree *octree, int sz, float x, float y, float z, float ex
 
             if (childrenSizes[code] == 0) {
                 childrenBegins[code] = index;
+                mask |= 1 << code;
             }
             else {
                 octree->successors[childrenEnds[code]] = index;
@@ -219,11 +267,21 @@ Octant* createOctant(Octree *octree, int sz, float x, float y, float z, float ex
             index = octree->successors[index];
         }
 
+        // copies of one point can't be split, they stay in a fat leaf. The
+        // chain of points of a single child is the octant's own chain
+        if (childrenSizes[code] == sz && samePoints(octree, beginInd, sz)) {
+            oct->lo = oct->hi = pts[beginInd];
+            return;
+        }
+
+        c = allocOctants(octree, __builtin_popcount(mask));
+        oct = &octree->octants[octInd];
+        oct->childMask = mask;
+        oct->firstChild = c;
         childExt = 0.5f * ext;
-        first = 1;
-        lastChildInd = 0;
+        lastChildInd = -1;
 
-        for (i = 0; i < 8; i++) {
+        for (i = 0, c = 0; i < 8; i++) {
             if (childrenSizes[i] == 0) {
                 continue;
             }
@@ -233,27 +291,53 @@ Octant* createOctant(Octree *octree, int sz, float x, float y, float z, float ex
             childY = y + factor[(i & 2) > 0] * ext;
             childZ = z + factor[(i & 4) > 0] * ext;
 
-            oct->children[i] = createOctant(octree, childrenSizes[i], childX, childY, childZ, childExt, childrenBegins[i], childrenEnds[i]);
+            createOctant(octree, octree->octants[octInd].firstChild + c, childrenSizes[i], childX, childY, childZ, childExt,
+                childrenBegins[i], childrenEnds[i], depth + 1);
+            oct = &octree->octants[octInd];
+            child = &octree->octants[oct->firstChild + c];
 
-            // indexing children
-            if (first) {
-                oct->begin = oct->children[i]->begin;
+            // indexing children, the box of the octant bounds theirs
+            if (lastChildInd < 0) {
+                oct->begin = child->begin;
+                oct->lo = child->lo;
+                oct->hi = child->hi;
             }
             else {
-                octree->successors[oct->children[lastChildInd]->end] = oct->children[i]->begin;
+                octree->successors[octree->octants[lastChildInd].end] = child->begin;
+                oct->lo.x = fminf(oct->lo.x, child->lo.x);
+                oct->lo.y = fminf(oct->lo.y, child->lo.y);
+                oct->lo.z = fminf(oct->lo.z, child->lo.z);
+                oct->hi.x = fmaxf(oct->hi.x, child->hi.x);
+                oct->hi.y = fmaxf(oct->hi.y, child->hi.y);
+                oct->hi.z = fmaxf(oct->hi.z, child->hi.z);
             }
 
-            lastChildInd = i;
-            first = 0;
-            oct->end = oct->children[i]->end;
+            lastChildInd = oct->firstChild + c++;
+            oct->end = child->end;
         }
     }
-    return oct;
+    else if (sz > 0)
+        chainBox(octree, beginInd, sz, &oct->lo, &oct->hi);
+}
+
+#ifdef QUERY_STATS
+__thread QueryStats threadStats;
+static QueryStats runStats; // merged counters of the threads
+
+// histogram bucket b holds counts in [2^(b-1), 2^b), bucket 0 zeros
+static int statsBucket(long count)
+{
+    int b = count ? 64 - __builtin_clzl(count) : 0;
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
 }
+#endif
 
-void findKNearest(Octree *octree, int k, float radius, Point **result, int *resultSize, int usingRadius, float **dists)
+void findKNearest(Octree *octree, Point query, int k, float radius, Point **result, int *resultSize, int usingRadius, float **dists)
 {
     float sqrRadius;
+#ifdef QUERY_STATS
+    long distances = threadStats.distances, nodes = threadStats.innerNodes + threadStats.leaves;
+#endif
 
     *result = malloc(sizeof(Point) * k);
     *dists = malloc(sizeof(float) * k);
@@ -261,144 +345,402 @@ void findKNearest(Octree *octree, int k, float radius, Point **result, int *resu
         sqrRadius = pow(radius, 2);
     else
         sqrRadius = radius;
-    findKNearestRecursive(octree, octree->root, k, &sqrRadius, *result, resultSize, *dists);
+    findKNearestRecursive(octree, &octree->octants[0], query, k, &sqrRadius, *result, resultSize, *dists);
+#ifdef QUERY_STATS
+    threadStats.queries++;
+    distances = threadStats.distances - distances;
+    nodes = threadStats.innerNodes + threadStats.leaves - nodes;
+    threadStats.distanceHistogram[statsBucket(distances)]++;
+    threadStats.nodeHistogram[statsBucket(nodes)]++;
+#endif
 }
 
-void findKNearestRecursive(Octree *octree, Octant *octant, int k, float *sqrRadius, Point *result, int *resultSize, float *dists)
+void findKNearestRecursive(Octree *octree, Octant *octant, Point query, int k, float *sqrRadius, Point *result, int *resultSize, float *dists)
 {
-    int index, i = 0, currChildrenSize = 0;
+    PointIndex index, copies;
+    int i = 0, j, currChildrenSize = 0;
     float dist;
 
     Point *pts = octree->points;
     Point currPoint;
-    Octant* currChildren[8];
+    Octant *children, *currChildren[8];
+    float childrenDists[8];
 
-    if (octant->isLeaf) {
+    if (isLeaf(octant)) {
+        countStat(leaves);
         index = octant->begin;
         for (i = 0; i < octant->size; i++) {
             currPoint = pts[index];
-            dist = sqrDist(p, currPoint);
+            dist = sqrDist(query, currPoint);
+            countStat(distances);
             if (dist < *sqrRadius && dist > 0) {
-                if (*resultSize == k)
-                    (*resultSize)--;
-                (*resultSize)++;
-                result[(*resultSize)-1] = currPoint;
-                dists[(*resultSize)-1] = dist;
-           
-                qsort(result, *resultSize, sizeof(Point), pointComp);
-                qsort(dists, *resultSize, sizeof(float), floatComp);
-                
-                if(*resultSize == k)
-                    *sqrRadius = sqrDist(p, result[(*resultSize)-1]);
+                // a point of a deduplicated cloud is inserted once per copy
+                copies = octree->weights ? octree->weights[index] : 1;
+                do {
+                    // inserting the point into the list of neighbors sorted by distance,
+                    // the farthest one is dropped when the list is full
+                    countStat(accepted);
+                    if (*resultSize < k)
+                        (*resultSize)++;
+                    for (j = *resultSize - 1; j > 0 && dists[j-1] > dist; j--) {
+                        result[j] = result[j-1];
+                        dists[j] = dists[j-1];
+                    }
+                    result[j] = currPoint;
+                    dists[j] = dist;
+
+                    if(*resultSize == k) {
+                        *sqrRadius = dists[(*resultSize)-1];
+                        countStat(boundUpdates);
+                    }
+                } while (--copies > 0 && dist < *sqrRadius);
             }
             index = octree->successors[index];
         }
     }
     else {
-        for (i = 0; i < 8; i++) {
-            if (octant->children[i] != 0) {
-                currChildrenSize++;
-                currChildren[currChildrenSize-1] = octant->children[i];
+        countStat(innerNodes);
+        // children sorted by distance from the query point to their boxes
+        children = &octree->octants[octant->firstChild];
+        for (i = 0; i < childCount(octant); i++) {
+            dist = boxSqrDist(&children[i], query);
+            for (j = currChildrenSize; j > 0 && childrenDists[j-1] > dist; j--) {
+                currChildren[j] = currChildren[j-1];
+                childrenDists[j] = childrenDists[j-1];
             }
+            currChildren[j] = &children[i];
+            childrenDists[j] = dist;
+            currChildrenSize++;
         }
-        qsort(currChildren, currChildrenSize, sizeof(Octant*), octantComp);
 
+        // the search radius shrinks while the nearer children are visited
         for (i = 0; i < currChildrenSize; i++) {
-            if (intersects(currChildren[i], *sqrRadius))
-                findKNearestRecursive(octree, currChildren[i], k, sqrRadius, result, resultSize, dists);
+            if (childrenDists[i] < *sqrRadius)
+                findKNearestRecursive(octree, currChildren[i], query, k, sqrRadius, result, resultSize, dists);
+            else
+                countStat(pruned);
         }
     }
 }
 
-void RORfilter(Octree *octree, int k, float radius, int size, int *result, long *resultSize) 
+void RORfilter(Octree *octree, int k, float radius, PointIndex size, PointIndex *result, long *resultSize) 
+{
+    RORfilterRange(octree, k, radius, 0, size, result, resultSize);
+}
+
+// ROR filtering of the points with indexes in [begin, end)
+void RORfilterRange(Octree *octree, int k, float radius, PointIndex begin, PointIndex end, PointIndex *result, long *resultSize)
+{
+    MaskWord *keep = allocMask(end - begin);
+
+    // indexes are collected in order after the parallel part
+    countAlloc(ALLOC_RESULTS, maskWords(end - begin) * sizeof(MaskWord));
+    RORfilterMask(octree, k, radius, begin, end, keep);
+    *resultSize += maskToIndexes(keep, end - begin, begin, result + *resultSize);
+    free(keep);
+    countFree(ALLOC_RESULTS, maskWords(end - begin) * sizeof(MaskWord));
+}
+
+// ROR filtering of the points with indexes in [begin, end) into a zeroed mask,
+// bit i - begin is set for a kept point i. Threads take whole words of the mask
+void RORfilterMask(Octree *octree, int k, float radius, PointIndex begin, PointIndex end, MaskWord *keep)
 {
-    int i, innerResultSize;
-    Point *currNeighbors = NULL;
-    float *currDists = NULL;
-    for (i = 0; i < size; i++) 
+    PointIndex w;
+
+    #pragma omp parallel
     {
-        innerResultSize = 0;
-        p = octree->points[i];
-        findKNearest(octree, k, radius, &currNeighbors, &innerResultSize, ROR_FILTER, &currDists);
-        if (innerResultSize >= k) 
+        int innerResultSize;
+        Point *currNeighbors = NULL;
+        float *currDists = NULL;
+        PointIndex i, need;
+        MaskWord bits;
+        double span;
+
+        // a thread holds the lists of one query at a time
+        countAlloc(ALLOC_WORKSPACES, (long) k * (sizeof(Point) + sizeof(float)));
+        #pragma omp for schedule(dynamic, (FILTER_CHUNK + MASK_BITS - 1) / MASK_BITS)
+        for (w = 0; w < maskWords(end - begin); w++) 
         {
-            (*resultSize)++;
-            result[(*resultSize)-1] = i;
+            span = traceBegin();
+            bits = 0;
+            for (i = begin + w * MASK_BITS; i < end && i < begin + (w + 1) * MASK_BITS; i++) {
+                // other copies of a point of a deduplicated cloud are its neighbors
+                need = k - (octree->weights ? octree->weights[i] - 1 : 0);
+                if (need <= 0) {
+                    bits |= 1UL << (i - begin - w * MASK_BITS);
+                    continue;
+                }
+                innerResultSize = 0;
+                findKNearest(octree, octree->points[i], need, radius, &currNeighbors, &innerResultSize, ROR_FILTER, &currDists);
+                if (innerResultSize >= need)
+                    bits |= 1UL << (i - begin - w * MASK_BITS);
+                free(currNeighbors);
+                free(currDists);
+                currNeighbors = NULL;
+                currDists = NULL;
+            }
+            keep[w] = bits;
+            traceEnd("ror chunk", span);
         }
-        free(currNeighbors);
-        free(currDists);
-        currNeighbors = NULL;
-        currDists = NULL;
+        countFree(ALLOC_WORKSPACES, (long) k * (sizeof(Point) + sizeof(float)));
+        mergeStats();
+    }
+}
+
+// adding the mean distances of size points and their squares to sums[0] and sums[1].
+// Points of a deduplicated cloud count once per copy with weights, NULL otherwise.
+// Sums are kept in double, so that slices, tiles and whole clouds get the same threshold
+void SORaddSums(const float *meanDists, const PointIndex *weights, PointIndex size, double *sums)
+{
+    PointIndex i;
+    double dist, w = 1.0;
+
+    for (i = 0; i < size; i++) {
+        if (weights)
+            w = weights[i];
+        dist = meanDists[i];
+        sums[0] += w * dist;
+        sums[1] += w * dist * dist;
     }
 }
 
-void SORfilter(Octree *octree, int size, int meanK, float multiplier, int *result, long *resultSize) {
-    int i, j = 0, innerResultSize;
+// threshold multiplier standard deviations above the mean of count mean distances with given sums
+float SORsumsThreshold(const double *sums, long count, float multiplier)
+{
+    double mean = sums[0] / count;
+    double variance = (sums[1] - sums[0] * sums[0] / count) / (count - 1);
+
+    return mean + multiplier * sqrt(variance);
+}
+
+// threshold of the mean distances of size points, multiplier standard deviations above their mean
+float SORthreshold(const float *meanDists, const PointIndex *weights, PointIndex size, float multiplier)
+{
+    double sums[2] = { 0.0, 0.0 };
+    long count = weights ? 0 : size;
+    PointIndex i;
+
+    for (i = 0; weights && i < size; i++)
+        count += weights[i];
+    SORaddSums(meanDists, weights, size, sums);
+    return SORsumsThreshold(sums, count, multiplier);
+}
+
+void SORfilter(Octree *octree, PointIndex size, int meanK, float multiplier, PointIndex *result, long *resultSize) {
     float *meanDists = malloc(sizeof(float) * size);
-    float meanDistsSum = 0.0f, meanDistsSquareSum = 0.0f;
-    Point *currNeighbors = NULL;
-    float *currDists = NULL;
-    float currDistSum = 0.0f;
+    float threshold;
 
-    float mean, variance, stddev, threshold;
+    countAlloc(ALLOC_RESULTS, (long) sizeof(float) * size);
 
     // first pass: mean distances for all points
-    for (i = 0; i < size; i++) 
-    {
-        innerResultSize = 0;
-        p = octree->points[i];
-        findKNearest(octree, meanK, FLT_MAX, &currNeighbors, &innerResultSize, SOR_FILTER, &currDists);
-
-        for (j = 0; j < innerResultSize; j++)
-            currDistSum += sqrt(currDists[j]);
-        meanDists[i] = currDistSum / innerResultSize;
-         
-        free(currNeighbors);
-        free(currDists);
-        currNeighbors = NULL;
-        currDists = NULL;
-        currDistSum = 0;        
-    }
+    SORmeanDists(octree, meanK, 0, size, meanDists);
+    threshold = SORthreshold(meanDists, octree->weights, size, multiplier);
 
-    for (i = 0; i < size; i++) {
-        meanDistsSum += meanDists[i];
-        meanDistsSquareSum += meanDists[i] * meanDists[i];
-    }
+    // second pass: selecting indexes of points to stay
+    SORselect(meanDists, 0, size, threshold, result, resultSize);
 
-    mean = meanDistsSum / (float)size;
-    variance = (meanDistsSquareSum - meanDistsSum * meanDistsSum / size) / (size - 1);
-    stddev = sqrt(variance);
-    threshold = mean + multiplier * stddev;
+    free(meanDists);
+    countFree(ALLOC_RESULTS, (long) sizeof(float) * size);
+}
 
-    // second pass: selecting indexes of points to stay
-    for (i = 0; i < size; i++) {
-        if (meanDists[i] <= threshold) {
+// SOR filtering of all points into a zeroed keep-mask
+void SORfilterMask(Octree *octree, PointIndex size, int meanK, float multiplier, MaskWord *keep)
+{
+    float *meanDists = malloc(sizeof(float) * size);
+
+    countAlloc(ALLOC_RESULTS, (long) sizeof(float) * size);
+    SORmeanDists(octree, meanK, 0, size, meanDists);
+    SORselectMask(meanDists, 0, size, SORthreshold(meanDists, octree->weights, size, multiplier), keep);
+    free(meanDists);
+    countFree(ALLOC_RESULTS, (long) sizeof(float) * size);
+}
+
+// mean distances to meanK nearest neighbors of the points with indexes in [begin, end),
+// meanDists[i - begin] is filled for point i
+void SORmeanDists(Octree *octree, int meanK, PointIndex begin, PointIndex end, float *meanDists)
+{
+    PointIndex c;
+
+    #pragma omp parallel
+    {
+        int j, innerResultSize;
+        Point *currNeighbors = NULL;
+        float *currDists = NULL;
+        float currDistSum = 0.0f;
+        PointIndex i, zeros;
+        double span;
+
+        // a thread holds the lists of one query at a time
+        countAlloc(ALLOC_WORKSPACES, (long) meanK * (sizeof(Point) + sizeof(float)));
+        // threads take chunks of FILTER_CHUNK points
+        #pragma omp for schedule(dynamic)
+        for (c = begin; c < end; c += FILTER_CHUNK)
+        {
+            span = traceBegin();
+            for (i = c; i < end && i < c + FILTER_CHUNK; i++)
+            {
+                // other copies of a point of a deduplicated cloud are its nearest neighbors
+                zeros = octree->weights ? octree->weights[i] - 1 : 0;
+                if (zeros > meanK)
+                    zeros = meanK;
+                innerResultSize = 0;
+                if (zeros < meanK)
+                    findKNearest(octree, octree->points[i], meanK - zeros, FLT_MAX, &currNeighbors, &innerResultSize, SOR_FILTER, &currDists);
+
+                for (j = 0; j < innerResultSize; j++)
+                    currDistSum += sqrt(currDists[j]);
+                meanDists[i - begin] = currDistSum / (innerResultSize + zeros);
+
+                free(currNeighbors);
+                free(currDists);
+                currNeighbors = NULL;
+                currDists = NULL;
+                currDistSum = 0;
+            }
+            traceEnd("sor chunk", span);
+        }
+        countFree(ALLOC_WORKSPACES, (long) meanK * (sizeof(Point) + sizeof(float)));
+        mergeStats();
+    }
+}
+
+// selecting indexes of points in [begin, end) whose mean distance doesn't exceed the threshold
+void SORselect(float *meanDists, PointIndex begin, PointIndex end, float threshold, PointIndex *result, long *resultSize)
+{
+    PointIndex i;
+    for (i = begin; i < end; i++) {
+        if (meanDists[i - begin] <= threshold) {
             (*resultSize)++;
             result[(*resultSize)-1] = i;
         }
     }
+}
 
-    free(meanDists);
+// selection of the points in [begin, end) into a mask, bit i - begin for point i
+void SORselectMask(float *meanDists, PointIndex begin, PointIndex end, float threshold, MaskWord *keep)
+{
+    PointIndex w, i;
+    MaskWord bits;
+
+    #pragma omp parallel for private(i, bits)
+    for (w = 0; w < maskWords(end - begin); w++) {
+        bits = 0;
+        for (i = w * MASK_BITS; i < end - begin && i < (w + 1) * MASK_BITS; i++)
+            if (meanDists[i] <= threshold)
+                bits |= 1UL << (i - w * MASK_BITS);
+        keep[w] = bits;
+    }
+}
+
+#ifdef QUERY_STATS
+// adds the counters of the calling thread to those of the run and clears them
+void mergeThreadStats()
+{
+    long *from = (long *) &threadStats, *to = (long *) &runStats;
+    int i;
+
+    #pragma omp critical(queryStats)
+    for (i = 0; i < (int) (sizeof(QueryStats) / sizeof(long)); i++)
+        to[i] += from[i];
+    memset(&threadStats, 0, sizeof(QueryStats));
+}
+
+// counters merged since the last call, those of the calling thread included
+void takeQueryStats(QueryStats *stats)
+{
+    mergeThreadStats();
+    *stats = runStats;
+    memset(&runStats, 0, sizeof(QueryStats));
+}
+
+static void printHistogram(const char *name, const long *histogram)
+{
+    int b;
+
+    printf("%s per query:\n", name);
+    for (b = 0; b < STATS_BUCKETS; b++)
+        if (histogram[b])
+            printf("  %10ld..%-10ld %ld\n", b ? 1L << (b - 1) : 0L, b ? (1L << b) - 1 : 0L, histogram[b]);
+}
+
+void printQueryStats(const QueryStats *stats)
+{
+    double queries = stats->queries > 0 ? stats->queries : 1;
+
+    printf("\n%ld queries, per query:\n", stats->queries);
+    printf("  inner nodes visited   %12.2f\n", stats->innerNodes / queries);
+    printf("  leaves scanned        %12.2f\n", stats->leaves / queries);
+    printf("  distance evaluations  %12.2f\n", stats->distances / queries);
+    printf("  accepted candidates   %12.2f\n", stats->accepted / queries);
+    printf("  pruned subtrees       %12.2f\n", stats->pruned / queries);
+    printf("  bound updates         %12.2f\n", stats->boundUpdates / queries);
+    printHistogram("Distance evaluations", stats->distanceHistogram);
+    printHistogram("Octants visited", stats->nodeHistogram);
+}
+#endif
+
+// square distance from p to the tight box of the points of an octant, 0 inside.
+// It is computed like sqrDist, so it never exceeds the distance to one of them
+float boxSqrDist(const Octant *oct, Point p)
+{
+    float x = max(max(oct->lo.x - p.x, p.x - oct->hi.x), 0.0f);
+    float y = max(max(oct->lo.y - p.y, p.y - oct->hi.y), 0.0f);
+    float z = max(max(oct->lo.z - p.z, p.z - oct->hi.z), 0.0f);
+
+    return pow(x, 2) + pow(y, 2) + pow(z, 2);
 }
 
 // does an octant intersect with a sphere of a given radius with a center in point p?
-int intersects(Octant *oct, float sqrRadius)
+int intersects(Octant *oct, Point p, float sqrRadius)
+{
+    return boxSqrDist(oct, p) < sqrRadius;
+}
+
+double AWGN_generator()
 {
-    float x = abs(p.x - oct->center.x);
-    float y = abs(p.y - oct->center.y);
-    float z = abs(p.z - oct->center.z);
-    float maxdist = sqrt(sqrRadius) + oct->extent;
-    int check;
+    /* Generates additive white Gaussian Noise samples with zero mean and a standard deviation of 1. */
 
-    if (x > maxdist || y > maxdist || z > maxdist)
-        return 0;
-    
-    check = (x < oct->extent) + (y < oct->extent) + (z < oct->extent);
-    if (check > 1)
-        return 1;
-    
-    x = max(x - oct->extent, 0.0f); 
-    y = max(y - oct->extent, 0.0f);
-    z = max(z - oct->extent, 0.0f);
-    return (pow(x, 2) + pow(y, 2) + pow(z, 2) < sqrRadius);
-}
\ No newline at end of file
+    double temp1;
+    double temp2;
+    double result;
+    int p;
+
+    p = 1;
+
+    while( p > 0 )
+    {
+    temp2 = ( rand() / ( (double)RAND_MAX ) ); /*  rand() function generates an
+                                                        integer between 0 and  RAND_MAX,
+                                                        which is defined in stdlib.h.
+                                                    */
+
+    if ( temp2 == 0 )
+    {// temp2 is >= (RAND_MAX / 2)
+        p = 1;
+    }// end if
+    else
+    {// temp2 is < (RAND_MAX / 2)
+        p = -1;
+    }// end else
+
+    }// end while()
+
+    temp1 = cos( ( 2.0 * (double)PI ) * rand() / ( (double)RAND_MAX ) );
+    result = sqrt( -2.0 * log( temp2 ) ) * temp1;
+
+    return result;	
+    // return the generated random sample to the caller
+
+}// end AWGN_generator()
+
+// AWGN_generator drawing from a state of the caller with rand_r, so that
+// threads can noise their points concurrently and reproducibly
+double AWGN_generator_r(unsigned int *state)
+{
+    double u;
+
+    do
+        u = rand_r(state) / (double) RAND_MAX;
+    while (u == 0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * PI * rand_r(state) / (double) RAND_MAX);
+}
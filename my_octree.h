@@ -1,17 +1,34 @@
 #ifndef MY_OCTREE_H
 #define MY_OCTREE_H
-#define BUCKET_SIZE 32 // max number of points in a leaf octant
+#define BUCKET_SIZE 32 // default max number of points in a leaf octant
+// default max depth of leaves below the root, 0 for no limit. Octants 2^24
+// times smaller than the root reach the float resolution of the coordinates,
+// near-duplicates below it would be split until the extent underflows
+#define MAX_DEPTH 24
 #define ROR_FILTER 0
 #define SOR_FILTER 1
 
+// type of point indexes: int keeps octants and index arrays compact, long is
+// used when compiled with -DINDEX64 for clouds beyond 2^31 points
+#ifdef INDEX64
+typedef long PointIndex;
+#else
+typedef int PointIndex;
+#endif
+
+// filters may return a keep-mask, one bit per point in a word of MASK_BITS,
+// instead of an array of kept indexes. Bits past the last point are zero
+typedef unsigned long MaskWord;
+#define MASK_BITS 64
+#define maskWords(n) (((n) + MASK_BITS - 1) / MASK_BITS)
+
 // point structure
 
 typedef struct Point {
     float x, y, z;
 } Point;
 
-Point *inputpts, *resultpts;
-Point p;
+extern Point *inputpts; // points of the cloud loaded by main
 
 // utility functions
 
@@ -20,26 +37,42 @@ float max(float, float);
 
 // Octree and Octant structures
 
+// 44 bytes with 32-bit point indexes, so that most octants sit in one cache
+// line. The cube of an octant is only needed by the build, queries use the box
+
 typedef struct Octant {
-    int isLeaf;
-    struct Octant* children[8];
-    int size;
-    int begin;
-    int end;
-    Point center;
-    float extent;
+    Point lo, hi; // tight bounding box of the octant's points, within its cube
+    PointIndex size;
+    PointIndex begin;
+    PointIndex end;
+    int firstChild; // index of the first child in the octree's octant array, its siblings follow it
+    unsigned char childMask; // bit i set if child i exists, 0 for leaves
 } Octant;
 
+// children of an inner octant in the order of their bits, the one of bit i is
+// at firstChild + popcount of the lower bits
+#define childCount(oct) __builtin_popcount((oct)->childMask)
+#define isLeaf(oct) (!(oct)->childMask)
+
+// octants are kept in one contiguous array without pointers, so that a built
+// octree can be copied into memory shared between processes
+
 typedef struct Octree {
-    Octant* root;
+    Octant* octants; // root is the first one
+    int noctants;
+    int capacity;
     Point* points;
-    int* successors;
+    PointIndex* successors;
+    PointIndex successorsCapacity;
+    int ownsPoints; // points are freed with the octree, set by default
+    int shared; // memory is owned by a shared window, not freed with the octree
+    int bucketSize; // of the last build
+    int maxDepth;
+    const PointIndex *weights; // copies of every point of a deduplicated cloud, NULL if every point is one
 } Octree;
 
-// comparators for sorting neighbors and octants
+// comparator for sorting distances
 int floatComp(const void*, const void*);
-int pointComp(const void*, const void*);
-int octantComp(const void*, const void*);
 
 // initialization and deletion of Octree/Octant
 
@@ -47,65 +80,83 @@ void initOctree(Octree *);
 void deleteOctree(Octree *);
 
 void initOctant(Octant *);
-void deleteOctant(Octant *);
 
 // building/clearing Octree, creating octants
 
-void buildOctree(Octree *, Point *, int);
+void buildOctree(Octree *, Point *, PointIndex, int, int);
 void clearOctree(Octree *);
-
-Octant* createOctant(Octree *, int, float, float, float, float, int, int);
-
-// k nearest neighbors search and filtering
-
-void findKNearest(Octree *, int, float, Point **, int *, int, float **);
-void findKNearestRecursive(Octree *, Octant *, int, float *, Point *, int *, float *);
-void RORfilter(Octree *, int, float, int, int *, long *);
-void SORfilter(Octree *, int, int, float, int *, long *);
-
-int intersects(Octant *, float);
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <math.h>
-
-#define PI 3.1415926536
-
-double AWGN_generator()
-{
-    /* Generates additive white Gaussian Noise samples with zero mean and a standard deviation of 1. */
-
-    double temp1;
-    double temp2;
-    double result;
-    int p;
-
-    p = 1;
-
-    while( p > 0 )
-    {
-    temp2 = ( rand() / ( (double)RAND_MAX ) ); /*  rand() function generates an
-                                                        integer between 0 and  RAND_MAX,
-                                                        which is defined in stdlib.h.
-                                                    */
-
-    if ( temp2 == 0 )
-    {// temp2 is >= (RAND_MAX / 2)
-        p = 1;
-    }// end if
-    else
-    {// temp2 is < (RAND_MAX / 2)
-        p = -1;
-    }// end else
-
-    }// end while()
-
-    temp1 = cos( ( 2.0 * (double)PI ) * rand() / ( (double)RAND_MAX ) );
-    result = sqrt( -2.0 * log( temp2 ) ) * temp1;
-
-    return result;	
-    // return the generated random sample to the caller
-
-}// end AWGN_generator()
+void resetOctree(Octree *);
+
+void createOctant(Octree *, int, PointIndex, float, float, float, float, PointIndex, PointIndex, int);
+
+// k nearest neighbors search and filtering, queries don't share any state
+// so filters process points in parallel with OpenMP
+
+void findKNearest(Octree *, Point, int, float, Point **, int *, int, float **);
+void findKNearestRecursive(Octree *, Octant *, Point, int, float *, Point *, int *, float *);
+void RORfilter(Octree *, int, float, PointIndex, PointIndex *, long *);
+void SORfilter(Octree *, PointIndex, int, float, PointIndex *, long *);
+void RORfilterMask(Octree *, int, float, PointIndex, PointIndex, MaskWord *);
+void SORfilterMask(Octree *, PointIndex, int, float, MaskWord *);
+
+// parameters of a filtering run shared by the tiled and batch modes
+
+typedef struct FilterParams {
+    char filterType;    // R or S
+    int k;              // min number of neighbors for ROR, mean k for SOR
+    float radius;       // ROR search radius, SOR multiplier
+    float noiseProb;
+    int binary;         // output format
+    float tileSize;     // edge of a tile for tiled filtering
+    int bucketSize;     // of the built octrees
+    int maxDepth;
+} FilterParams;
+
+// filtering of index ranges, used to split the work between processes
+void RORfilterRange(Octree *, int, float, PointIndex, PointIndex, PointIndex *, long *);
+void SORmeanDists(Octree *, int, PointIndex, PointIndex, float *);
+void SORselect(float *, PointIndex, PointIndex, float, PointIndex *, long *);
+void SORselectMask(float *, PointIndex, PointIndex, float, MaskWord *);
+void SORaddSums(const float *, const PointIndex *, PointIndex, double *);
+float SORsumsThreshold(const double *, long, float);
+float SORthreshold(const float *, const PointIndex *, PointIndex, float);
+
+float boxSqrDist(const Octant *, Point);
+int intersects(Octant *, Point, float);
+
+// traversal counters of the queries, compiled in with -DQUERY_STATS. Every
+// thread counts into its own copy, copies are merged when a filter's parallel
+// part ends, so counting doesn't make threads share anything while querying
+#ifdef QUERY_STATS
+#define STATS_BUCKETS 32 // log2 buckets of the per-query histograms
+
+typedef struct QueryStats {
+    long queries;
+    long innerNodes;    // inner octants visited
+    long leaves;        // leaf octants scanned
+    long distances;     // point distance evaluations
+    long accepted;      // points inserted into the neighbor list
+    long pruned;        // children skipped as out of the search radius
+    long boundUpdates;  // search radius shrunk by a full neighbor list
+    long distanceHistogram[STATS_BUCKETS];  // queries by distance evaluations
+    long nodeHistogram[STATS_BUCKETS];      // queries by octants visited
+} QueryStats;
+
+extern __thread QueryStats threadStats;
+#define countStat(field) (threadStats.field++)
+#define mergeStats() mergeThreadStats()
+
+void mergeThreadStats();
+void takeQueryStats(QueryStats *);
+void printQueryStats(const QueryStats *);
+#else
+#define countStat(field) ((void)0)
+#define mergeStats() ((void)0)
+#endif
+
+// Gaussian noise sample with zero mean and a standard deviation of 1, from
+// rand() or from a generator state of the caller
+double AWGN_generator();
+double AWGN_generator_r(unsigned int *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "octree_index.h"
+#include "mask.h"
+#include "alloc.h"
+
+#define INDEX_MAGIC "OCTINDEX"
+#define INDEX_ALIGN 64 // alignment of the arrays in the file
+#define INDEX_BLOCK (64 * 1024) // points reordered before one write
+
+typedef struct IndexHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;     // 0x01020304 as written by the host
+    unsigned int pointSize;     // sizeof(Point) and sizeof(Octant) of the writer
+    unsigned int octantSize;
+    unsigned int indexSize;     // sizeof(PointIndex) of the writer
+    unsigned int bucketSize;    // of the build
+    unsigned int maxDepth;
+    unsigned int reserved;
+    long sourceSize;
+    long sourceMtime;
+    long sourceMtimeNsec;
+    long npoints;
+    long noctants;
+    long pointsOffset;
+    long orderOffset;
+    long successorsOffset;
+    long octantsOffset;
+    long fileSize;
+} IndexHeader;
+
+static long alignOffset(long offset)
+{
+    return (offset + INDEX_ALIGN - 1) / INDEX_ALIGN * INDEX_ALIGN;
+}
+
+// expected header of an index of a source file, without the counts
+static int sourceHeader(const char *source, IndexHeader *header)
+{
+    struct stat st;
+
+    memset(header, 0, sizeof(IndexHeader));
+    if (stat(source, &st))
+        return 0;
+    memcpy(header->magic, INDEX_MAGIC, 8);
+    header->version = OCTREE_INDEX_VERSION;
+    header->byteOrder = 0x01020304;
+    header->pointSize = sizeof(Point);
+    header->octantSize = sizeof(Octant);
+    header->indexSize = sizeof(PointIndex);
+    header->sourceSize = st.st_size;
+    header->sourceMtime = st.st_mtim.tv_sec;
+    header->sourceMtimeNsec = st.st_mtim.tv_nsec;
+    return 1;
+}
+
+static int writeAt(FILE *file, long offset, const void *data, size_t size)
+{
+    return !fseek(file, offset, SEEK_SET) && fwrite(data, 1, size, file) == size;
+}
+
+// writes the index of a source file from a built octree. Points are put in
+// leaf order by following the successors from the root, the octree itself
+// isn't changed. The file is written under a temporary name and renamed, so
+// that a partly written index is never opened
+int saveOctreeIndex(const char *path, const char *source, const Octree *octree)
+{
+    IndexHeader header;
+    const Octant *root = &octree->octants[0];
+    char tmpPath[4200];
+    PointIndex *order, *position, *block;
+    Point *pts;
+    Octant octant;
+    FILE *file;
+    long n = root->size, i, j, index;
+    int ok;
+
+    if (!octree->noctants || !sourceHeader(source, &header))
+        return 0;
+    header.npoints = n;
+    header.noctants = octree->noctants;
+    header.bucketSize = octree->bucketSize;
+    header.maxDepth = octree->maxDepth;
+    header.pointsOffset = alignOffset(sizeof(IndexHeader));
+    header.orderOffset = alignOffset(header.pointsOffset + sizeof(Point) * n);
+    header.successorsOffset = alignOffset(header.orderOffset + sizeof(PointIndex) * n);
+    header.octantsOffset = alignOffset(header.successorsOffset + sizeof(PointIndex) * n);
+    header.fileSize = header.octantsOffset + sizeof(Octant) * octree->noctants;
+
+    // order[i] is the original index of the i-th point of the leaf order
+    order = malloc(sizeof(PointIndex) * n);
+    position = malloc(sizeof(PointIndex) * n);
+    for (i = 0, index = root->begin; i < n; i++, index = octree->successors[index]) {
+        order[i] = index;
+        position[index] = i;
+    }
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp%d", path, (int) getpid());
+    file = fopen(tmpPath, "wb");
+    if (!file) {
+        free(order);
+        free(position);
+        return 0;
+    }
+    ok = writeAt(file, 0, &header, sizeof(IndexHeader));
+
+    pts = malloc(sizeof(Point) * INDEX_BLOCK);
+    block = malloc(sizeof(PointIndex) * INDEX_BLOCK);
+    for (i = 0; ok && i < n; i += INDEX_BLOCK) {
+        for (j = 0; j < INDEX_BLOCK && i + j < n; j++) {
+            pts[j] = octree->points[order[i + j]];
+            block[j] = i + j + 1;
+        }
+        ok = writeAt(file, header.pointsOffset + sizeof(Point) * i, pts, sizeof(Point) * j) &&
+            writeAt(file, header.successorsOffset + sizeof(PointIndex) * i, block, sizeof(PointIndex) * j);
+    }
+    ok = ok && writeAt(file, header.orderOffset, order, sizeof(PointIndex) * n);
+    for (i = 0; ok && i < octree->noctants; i++) {
+        octant = octree->octants[i];
+        octant.begin = position[octant.begin];
+        octant.end = position[octant.end];
+        ok = writeAt(file, header.octantsOffset + sizeof(Octant) * i, &octant, sizeof(Octant));
+    }
+
+    free(pts);
+    free(block);
+    free(order);
+    free(position);
+    if (fclose(file))
+        ok = 0;
+    if (ok)
+        ok = !rename(tmpPath, path);
+    if (!ok)
+        unlink(tmpPath);
+    return ok;
+}
+
+// counting the arrays of a mapped index with countAlloc or countFree
+static void countMapping(const IndexHeader *header, void (*count)(int, long))
+{
+    count(ALLOC_POINTS, (long) sizeof(Point) * header->npoints);
+    count(ALLOC_SUCCESSORS, 2L * sizeof(PointIndex) * header->npoints);
+    count(ALLOC_OCTANTS, (long) sizeof(Octant) * header->noctants);
+}
+
+// maps the index of a source file into octree, which can be queried right
+// away. Returns 0 if there is no index, if it doesn't match the source file or
+// if it was built with another max depth or bucket size; any bucket size is
+// accepted for a bucket size of 0
+int openOctreeIndex(const char *path, const char *source, int bucketSize, int maxDepth, Octree *octree,
+    OctreeIndex *index)
+{
+    IndexHeader expected, *header;
+    struct stat st;
+    char *map;
+    int fd;
+
+    memset(index, 0, sizeof(OctreeIndex));
+    if (!sourceHeader(source, &expected))
+        return 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(IndexHeader)) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    header = (IndexHeader *) map;
+    expected.npoints = header->npoints;
+    expected.noctants = header->noctants;
+    expected.pointsOffset = header->pointsOffset;
+    expected.orderOffset = header->orderOffset;
+    expected.successorsOffset = header->successorsOffset;
+    expected.octantsOffset = header->octantsOffset;
+    expected.fileSize = header->fileSize;
+    expected.bucketSize = bucketSize ? (unsigned int) bucketSize : header->bucketSize;
+    expected.maxDepth = maxDepth;
+    if (memcmp(header, &expected, sizeof(IndexHeader)) || header->fileSize != st.st_size ||
+            header->noctants < 1) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    clearOctree(octree);
+    octree->points = (Point *) (map + header->pointsOffset);
+    octree->successors = (PointIndex *) (map + header->successorsOffset);
+    octree->octants = (Octant *) (map + header->octantsOffset);
+    octree->noctants = header->noctants;
+    octree->capacity = header->noctants;
+    octree->successorsCapacity = header->npoints;
+    octree->shared = 1; // the arrays belong to the mapping
+    octree->bucketSize = header->bucketSize;
+    octree->maxDepth = header->maxDepth;
+    index->map = map;
+    index->mapSize = st.st_size;
+    index->npoints = header->npoints;
+    index->order = (const PointIndex *) (map + header->orderOffset);
+    countMapping(header, countAlloc);
+    return 1;
+}
+
+void closeOctreeIndex(OctreeIndex *index)
+{
+    if (index->map) {
+        countMapping((const IndexHeader *) index->map, countFree);
+        munmap(index->map, index->mapSize);
+    }
+    memset(index, 0, sizeof(OctreeIndex));
+}
+
+// maps a keep-mask of leaf-ordered points, as returned by filters run on an
+// octree opened from an index, to a zeroed mask of the points of the source file
+void indexToSourceOrder(const OctreeIndex *index, const MaskWord *keep, MaskWord *sourceKeep)
+{
+    long w;
+    MaskWord bits;
+
+    for (w = 0; w < maskWords(index->npoints); w++)
+        for (bits = keep[w]; bits; bits &= bits - 1)
+            setMask(sourceKeep, index->order[w * MASK_BITS + __builtin_ctzl(bits)]);
+}
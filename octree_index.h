@@ -0,0 +1,28 @@
+#ifndef OCTREE_INDEX_H
+#define OCTREE_INDEX_H
+
+#include <stddef.h>
+
+#include "my_octree.h"
+
+// persistent octree index of a PLY file. Points are stored in leaf order, so
+// that every octant holds a contiguous range of them, followed by the original
+// index of every point, the successors and the flat octant array. The file is
+// mapped and used in place by the queries, its header holds the size and the
+// modification time of the source file so that stale indexes are detected, and
+// the bucket size and max depth the octree was built with
+#define OCTREE_INDEX_VERSION 5
+
+typedef struct OctreeIndex {
+    void *map;
+    size_t mapSize;
+    long npoints;
+    const PointIndex *order; // original index of every leaf-ordered point
+} OctreeIndex;
+
+int saveOctreeIndex(const char *, const char *, const Octree *);
+int openOctreeIndex(const char *, const char *, int, int, Octree *, OctreeIndex *);
+void closeOctreeIndex(OctreeIndex *);
+void indexToSourceOrder(const OctreeIndex *, const MaskWord *, MaskWord *);
+
+#endif
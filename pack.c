@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+#include "alloc.h"
+
+#define PACK_MAGIC "OCTPACK"
+#define MORTON_BITS 21 // bits of every coordinate in a 63-bit Morton code
+
+typedef struct PackHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;     // 0x01020304 as written by the host
+    long npoints;
+    long nblocks;
+    long indexOffset;           // of the block index
+    int nattributes;            // PackAttribute records follow the header
+    int attrStride;
+    double resolution;
+    double origin[3];           // coordinates of the quantization grid origin
+} PackHeader;
+
+typedef struct PackAttribute {
+    char name[PLY_NAME_MAX];
+    int type;
+} PackAttribute;
+
+typedef struct PackBlock {
+    long offset;        // of the encoded coordinates in the file
+    long npoints;
+    long coordBytes;    // attribute records follow the coordinates
+    long first[3];      // quantized coordinates of the first point
+} PackBlock;
+
+typedef struct MortonKey {
+    unsigned long code;
+    long index;
+} MortonKey;
+
+static unsigned long spreadBits(unsigned long v)
+{
+    unsigned long code = 0;
+    int i;
+    for (i = 0; i < MORTON_BITS; i++)
+        code |= ((v >> i) & 1UL) << (3 * i);
+    return code;
+}
+
+static int mortonComp(const void *a, const void *b)
+{
+    const MortonKey *x = a, *y = b;
+    if (x->code != y->code)
+        return x->code < y->code ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static unsigned char *putVarint(unsigned char *out, long value)
+{
+    unsigned long v = ((unsigned long) value << 1) ^ (unsigned long) (value >> 63); // zigzag
+    while (v >= 0x80) {
+        *out++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char) v;
+    return out;
+}
+
+static const unsigned char *getVarint(const unsigned char *in, const unsigned char *limit, long *value)
+{
+    unsigned long v = 0;
+    int shift = 0;
+    while (in < limit && (*in & 0x80) && shift < 63) {
+        v |= (unsigned long) (*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    if (in >= limit)
+        return NULL;
+    v |= (unsigned long) *in++ << shift;
+    *value = (long) (v >> 1) ^ -(long) (v & 1);
+    return in;
+}
+
+int isPackedFile(const char *filename)
+{
+    char magic[8];
+    FILE *file = fopen(filename, "rb");
+    int packed;
+    if (!file)
+        return 0;
+    packed = fread(magic, 1, 8, file) == 8 && !memcmp(magic, PACK_MAGIC, 8);
+    fclose(file);
+    return packed;
+}
+
+// bytes of the buffers writePacked holds for size points with the attributes of layout
+long packedWriterBytes(long size, const PlyLayout *layout)
+{
+    long n = size > 0 ? size : 1, nblocks = (n + PACK_BLOCK - 1) / PACK_BLOCK;
+
+    return (long) (3 * sizeof(long) + sizeof(MortonKey)) * n + (long) sizeof(PackBlock) * nblocks +
+        PACK_BLOCK * 30L + (layout->nattributes ? (long) PACK_BLOCK * layout->attrStride : 0);
+}
+
+// writes points pts[inds[i]] for i < size of a cloud (its first size points if
+// inds is NULL) and their attributes into a new container, quantized to
+// resolution. Returns 1 on success
+int writePacked(const char *filename, const PlyCloud *cloud, const PointIndex *inds, long size, double resolution)
+{
+    const PlyLayout *layout = &cloud->layout;
+    PackHeader header;
+    PackAttribute attr;
+    PackBlock *blocks;
+    MortonKey *keys;
+    FILE *file;
+    double lo[3], coords[3];
+    long *q, range = 0, prev[3], i, j, b;
+    unsigned char *buffer, *out;
+    char *attrs = NULL;
+    int attrStride = layout->nattributes ? layout->attrStride : 0, shift = 0, c, a, ok;
+
+    if (resolution <= 0)
+        return 0;
+    countAlloc(ALLOC_OUTPUT, packedWriterBytes(size, layout));
+    memset(&header, 0, sizeof(PackHeader));
+    memcpy(header.magic, PACK_MAGIC, 8);
+    header.version = PACK_VERSION;
+    header.byteOrder = 0x01020304;
+    header.npoints = size;
+    header.nblocks = (size + PACK_BLOCK - 1) / PACK_BLOCK;
+    header.nattributes = attrStride ? layout->nattributes : 0;
+    header.attrStride = attrStride;
+    header.resolution = resolution;
+
+    // quantization relative to the lowest corner of the kept points
+    for (c = 0; c < 3; c++)
+        lo[c] = size > 0 ? HUGE_VAL : 0.0;
+    for (i = 0; i < size; i++) {
+        const Point *p = &cloud->points[inds ? inds[i] : i];
+        lo[0] = p->x < lo[0] ? p->x : lo[0];
+        lo[1] = p->y < lo[1] ? p->y : lo[1];
+        lo[2] = p->z < lo[2] ? p->z : lo[2];
+    }
+    memcpy(header.origin, lo, sizeof(lo));
+    q = malloc(sizeof(long) * 3 * (size > 0 ? size : 1));
+    for (i = 0; i < size; i++) {
+        const Point *p = &cloud->points[inds ? inds[i] : i];
+        coords[0] = p->x;
+        coords[1] = p->y;
+        coords[2] = p->z;
+        for (c = 0; c < 3; c++) {
+            q[3 * i + c] = llround((coords[c] - lo[c]) / resolution);
+            range = q[3 * i + c] > range ? q[3 * i + c] : range;
+        }
+    }
+
+    // Morton order of the top bits of the quantized coordinates
+    while ((range >> shift) >= (1L << MORTON_BITS))
+        shift++;
+    keys = malloc(sizeof(MortonKey) * (size > 0 ? size : 1));
+    for (i = 0; i < size; i++) {
+        keys[i].code = spreadBits(q[3 * i] >> shift) | spreadBits(q[3 * i + 1] >> shift) << 1 |
+            spreadBits(q[3 * i + 2] >> shift) << 2;
+        keys[i].index = i;
+    }
+    qsort(keys, size, sizeof(MortonKey), mortonComp);
+
+    file = fopen(filename, "wb");
+    if (!file) {
+        free(q);
+        free(keys);
+        countFree(ALLOC_OUTPUT, packedWriterBytes(size, layout));
+        return 0;
+    }
+    ok = fwrite(&header, sizeof(PackHeader), 1, file) == 1;
+    for (a = 0; ok && a < header.nattributes; a++) {
+        memset(&attr, 0, sizeof(PackAttribute));
+        strcpy(attr.name, layout->attributes[a].name);
+        attr.type = layout->attributes[a].type;
+        ok = fwrite(&attr, sizeof(PackAttribute), 1, file) == 1;
+    }
+
+    blocks = malloc(sizeof(PackBlock) * (header.nblocks > 0 ? header.nblocks : 1));
+    buffer = malloc(PACK_BLOCK * 30);
+    if (attrStride)
+        attrs = malloc((size_t) PACK_BLOCK * attrStride);
+    for (b = 0; ok && b < header.nblocks; b++) {
+        PackBlock *block = &blocks[b];
+        block->offset = ftell(file);
+        block->npoints = size - b * PACK_BLOCK < PACK_BLOCK ? size - b * PACK_BLOCK : PACK_BLOCK;
+        i = keys[b * PACK_BLOCK].index;
+        for (c = 0; c < 3; c++)
+            block->first[c] = prev[c] = q[3 * i + c];
+        out = buffer;
+        for (j = 0; j < block->npoints; j++) {
+            i = keys[b * PACK_BLOCK + j].index;
+            for (c = 0; c < 3; c++) {
+                out = putVarint(out, q[3 * i + c] - prev[c]);
+                prev[c] = q[3 * i + c];
+            }
+            if (attrStride)
+                memcpy(attrs + j * attrStride, cloud->attributes + (size_t) (inds ? inds[i] : i) * attrStride, attrStride);
+        }
+        block->coordBytes = out - buffer;
+        ok = fwrite(buffer, 1, block->coordBytes, file) == (size_t) block->coordBytes;
+        if (ok && attrStride)
+            ok = fwrite(attrs, attrStride, block->npoints, file) == (size_t) block->npoints;
+    }
+
+    // the index goes last, the header is written again with its offset
+    header.indexOffset = ftell(file);
+    ok = ok && fwrite(blocks, sizeof(PackBlock), header.nblocks, file) == (size_t) header.nblocks;
+    ok = ok && !fseek(file, 0, SEEK_SET) && fwrite(&header, sizeof(PackHeader), 1, file) == 1;
+    if (fclose(file))
+        ok = 0;
+
+    free(q);
+    free(keys);
+    free(blocks);
+    free(buffer);
+    free(attrs);
+    countFree(ALLOC_OUTPUT, packedWriterBytes(size, layout));
+    return ok;
+}
+
+// decodes the coordinates and attributes of one block. Returns 0 on corrupted data
+static int decodeBlock(const char *map, size_t mapSize, const PackHeader *header, const PackBlock *block,
+    Point *pts, char *attrs)
+{
+    const unsigned char *in, *limit;
+    long value, q[3], i;
+    int c;
+
+    if (block->offset < 0 || block->coordBytes < 0 || block->npoints < 0 ||
+            (size_t) (block->offset + block->coordBytes + block->npoints * header->attrStride) > mapSize)
+        return 0;
+    in = (const unsigned char *) map + block->offset;
+    limit = in + block->coordBytes;
+    memcpy(q, block->first, sizeof(q));
+    for (i = 0; i < block->npoints; i++) {
+        for (c = 0; c < 3; c++) {
+            in = getVarint(in, limit, &value);
+            if (!in)
+                return 0;
+            q[c] += value;
+        }
+        pts[i].x = header->origin[0] + q[0] * header->resolution;
+        pts[i].y = header->origin[1] + q[1] * header->resolution;
+        pts[i].z = header->origin[2] + q[2] * header->resolution;
+    }
+    if (attrs && header->attrStride)
+        memcpy(attrs, map + block->offset + block->coordBytes, (size_t) block->npoints * header->attrStride);
+    return 1;
+}
+
+// maps a container and checks its header and index
+static char *mapPacked(const char *filename, size_t *mapSize, const PackHeader **header, const PackBlock **blocks)
+{
+    struct stat st;
+    char *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(PackHeader)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    *mapSize = st.st_size;
+    *header = (const PackHeader *) map;
+    *blocks = (const PackBlock *) (map + (*header)->indexOffset);
+    if (memcmp((*header)->magic, PACK_MAGIC, 8) || (*header)->version != PACK_VERSION ||
+            (*header)->byteOrder != 0x01020304 || (*header)->nattributes < 0 ||
+            (*header)->nattributes > PLY_MAX_ATTRIBUTES || (*header)->indexOffset < 0 ||
+            (size_t) ((*header)->indexOffset + sizeof(PackBlock) * (*header)->nblocks) > *mapSize) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    return map;
+}
+
+// layout of the points of a mapped container. Returns 1 if its attribute
+// records are valid
+static int packedLayout(const char *map, size_t mapSize, const PackHeader *header, PlyLayout *layout)
+{
+    const PackAttribute *attrs = (const PackAttribute *) (map + sizeof(PackHeader));
+    int a;
+
+    memset(layout, 0, sizeof(PlyLayout));
+    layout->mode = PLY_DEFAULT;
+    layout->offset = -1;
+    layout->nvertices = header->npoints;
+    if (sizeof(PackHeader) + sizeof(PackAttribute) * header->nattributes > mapSize)
+        return 0;
+    for (a = 0; a < header->nattributes; a++) {
+        // types index the tables of ply_io, lists aren't attributes
+        if (attrs[a].type < 0 || attrs[a].type >= PLY_LIST)
+            return 0;
+        memcpy(layout->attributes[a].name, attrs[a].name, PLY_NAME_MAX);
+        layout->attributes[a].name[PLY_NAME_MAX - 1] = '\0';
+        layout->attributes[a].type = attrs[a].type;
+        layout->attributes[a].offset = layout->attrStride;
+        layout->attrStride += plyTypeSize(attrs[a].type);
+    }
+    layout->nattributes = header->nattributes;
+    return layout->attrStride == header->attrStride;
+}
+
+// layout of the points of a container and its number of blocks, read by
+// readPackedBlock one by one. Returns 1 on success
+int readPackedLayout(const char *filename, PlyLayout *layout, long *nblocks)
+{
+    const PackHeader *header;
+    const PackBlock *blocks;
+    size_t mapSize;
+    char *map;
+    int ok;
+
+    map = mapPacked(filename, &mapSize, &header, &blocks);
+    if (!map)
+        return 0;
+    ok = packedLayout(map, mapSize, header, layout);
+    *nblocks = header->nblocks;
+    munmap(map, mapSize);
+    return ok;
+}
+
+// reads a whole container into the buffers of a cloud, blocks are decoded in
+// parallel straight into the point buffer. Returns 1 on success
+int readPacked(const char *filename, PlyCloud *cloud)
+{
+    PlyLayout *layout = &cloud->layout;
+    const PackHeader *header;
+    const PackBlock *blocks;
+    size_t mapSize;
+    char *map;
+    long *firsts, b;
+    int ok = 1;
+
+    map = mapPacked(filename, &mapSize, &header, &blocks);
+    if (!map)
+        return 0;
+    if (!packedLayout(map, mapSize, header, layout)) {
+        munmap(map, mapSize);
+        return 0;
+    }
+    reserveCloud(cloud, header->npoints);
+    cloud->size = header->npoints;
+
+    // block b starts at the sum of the sizes of the previous ones
+    firsts = malloc(sizeof(long) * (header->nblocks + 1));
+    firsts[0] = 0;
+    for (b = 0; b < header->nblocks; b++)
+        firsts[b + 1] = firsts[b] + blocks[b].npoints;
+    if (firsts[header->nblocks] != header->npoints)
+        ok = 0;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (b = 0; b < header->nblocks; b++) {
+        if (ok && !decodeBlock(map, mapSize, header, &blocks[b], cloud->points + firsts[b],
+                header->attrStride ? cloud->attributes + firsts[b] * header->attrStride : NULL)) {
+            #pragma omp atomic write
+            ok = 0;
+        }
+    }
+
+    free(firsts);
+    munmap(map, mapSize);
+    if (!ok) {
+        cloud->points = NULL;
+        cloud->size = 0;
+    }
+    return ok;
+}
+
+// random access to block b of a container, its points and attribute records
+// are written to pts and attrs (which may be NULL). Returns the number of
+// points of the block, -1 on failure
+long readPackedBlock(const char *filename, long b, Point *pts, char *attrs)
+{
+    const PackHeader *header;
+    const PackBlock *blocks;
+    size_t mapSize;
+    char *map;
+    long n = -1;
+
+    map = mapPacked(filename, &mapSize, &header, &blocks);
+    if (!map)
+        return -1;
+    if (b >= 0 && b < header->nblocks && blocks[b].npoints <= PACK_BLOCK && decodeBlock(map, mapSize, header, &blocks[b], pts, attrs))
+        n = blocks[b].npoints;
+    munmap(map, mapSize);
+    return n;
+}
@@ -0,0 +1,22 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "ply_io.h"
+
+// compressed container of point clouds. Points are sorted in Morton order and
+// split into blocks; coordinates are quantized to a given resolution and every
+// point is stored as zigzag varint deltas from the previous one of its block,
+// attribute records follow the coordinates of a block unchanged. An index of
+// the blocks at the end of the file lets them be decoded in parallel or one by one
+#define PACK_VERSION 1
+#define PACK_BLOCK 65536 // points of a block
+#define PACK_EXTENSION ".opk"
+
+int isPackedFile(const char *);
+int writePacked(const char *, const PlyCloud *, const PointIndex *, long, double);
+long packedWriterBytes(long, const PlyLayout *);
+int readPacked(const char *, PlyCloud *);
+int readPackedLayout(const char *, PlyLayout *, long *);
+long readPackedBlock(const char *, long, Point *, char *);
+
+#endif
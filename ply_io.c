@@ -0,0 +1,981 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ply_io.h"
+#include "pack.h"
+#include "alloc.h"
+
+#define READ_BLOCK (4 * 1024 * 1024) // bytes of binary vertex records read at once
+#define WRITE_BLOCK (64 * 1024) // points gathered before one write
+#define ASCII_LINE_MAX 160 // longest "%.6f %.6f %.6f\n" line of finite floats
+#define ASCII_VALUE_MAX 32 // longest printed attribute value
+#define ASCII_CHUNK (1024 * 1024) // bytes of ASCII data parsed by one task
+
+// type names as written into headers, order matches e_ply_type
+static const char *const typeNames[] = {
+    "int8", "uint8", "int16", "uint16",
+    "int32", "uint32", "float32", "float64",
+    "char", "uchar", "short", "ushort",
+    "int", "uint", "float", "double", "list"
+};
+
+// size in bytes of a scalar PLY type, 0 for lists
+int plyTypeSize(e_ply_type type)
+{
+    switch (type)
+    {
+        case PLY_INT8: case PLY_UINT8: case PLY_CHAR: case PLY_UCHAR:
+            return 1;
+        case PLY_INT16: case PLY_UINT16: case PLY_SHORT: case PLY_USHORT:
+            return 2;
+        case PLY_INT32: case PLY_UIN32: case PLY_INT: case PLY_UINT:
+        case PLY_FLOAT32: case PLY_FLOAT:
+            return 4;
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static int hostIsLittleEndian(void)
+{
+    unsigned int one = 1;
+    return *(unsigned char *) &one == 1;
+}
+
+// fixed record size of an element, 0 if it has list properties
+static int elementStride(p_ply_element element)
+{
+    p_ply_property property = NULL;
+    e_ply_type type;
+    int stride = 0, size;
+
+    while ((property = ply_get_next_property(element, property))) {
+        ply_get_property_info(property, NULL, &type, NULL, NULL);
+        size = plyTypeSize(type);
+        if (size == 0)
+            return 0;
+        stride += size;
+    }
+    return stride;
+}
+
+// reads the header of a PLY file and locates the vertex records in it.
+// Returns 0 if there are no vertices with x, y, z; offset is -1 if the
+// records have no fixed position and size
+int readPlyLayout(const char *filename, PlyLayout *layout)
+{
+    p_ply ply;
+    p_ply_element element = NULL;
+    p_ply_property property = NULL;
+    PlyAttribute *attr;
+    const char *name;
+    e_ply_type type;
+    long ninstances, offset;
+    int stride, column, lists = 0, found = 0, i;
+
+    memset(layout, 0, sizeof(PlyLayout));
+    ply = ply_open(filename, NULL, 0, NULL);
+    if (!ply)
+        return 0;
+    if (!ply_read_header(ply)) {
+        ply_close(ply);
+        return 0;
+    }
+    layout->mode = ply_get_storage_mode(ply);
+    layout->reverse = layout->mode != PLY_ASCII &&
+        (layout->mode == PLY_LITTLE_ENDIAN) != hostIsLittleEndian();
+    layout->dataOffset = ply_get_data_offset(ply);
+    offset = layout->dataOffset;
+
+    while ((element = ply_get_next_element(ply, element))) {
+        ply_get_element_info(element, &name, &ninstances);
+        stride = elementStride(element);
+        if (strcmp(name, "vertex")) {
+            // records or lines of preceding elements have to be skipped
+            if (offset >= 0)
+                offset = stride == 0 && ninstances > 0 ? -1 : offset + ninstances * stride;
+            layout->skipLines += ninstances;
+            continue;
+        }
+
+        layout->nvertices = ninstances;
+        layout->stride = stride;
+        for (i = 0; i < 3; i++)
+            layout->coordOffsets[i] = -1;
+        stride = 0;
+        column = 0;
+        while ((property = ply_get_next_property(element, property))) {
+            ply_get_property_info(property, &name, &type, NULL, NULL);
+            if (name[0] && !name[1] && name[0] >= 'x' && name[0] <= 'z') {
+                layout->coordOffsets[name[0] - 'x'] = stride;
+                layout->coordTypes[name[0] - 'x'] = type;
+                layout->coordColumns[name[0] - 'x'] = column;
+            }
+            else if (type == PLY_LIST || layout->nattributes == PLY_MAX_ATTRIBUTES ||
+                    strlen(name) >= PLY_NAME_MAX)
+                layout->dropped++;
+            else {
+                // any other scalar property is carried along with the point
+                attr = &layout->attributes[layout->nattributes++];
+                strcpy(attr->name, name);
+                attr->type = type;
+                attr->offset = layout->attrStride;
+                attr->fileOffset = stride;
+                attr->column = column;
+                layout->attrStride += plyTypeSize(type);
+            }
+            lists = lists || type == PLY_LIST;
+            stride += plyTypeSize(type);
+            column++;
+        }
+        layout->ncolumns = lists ? 0 : column;
+        found = layout->coordOffsets[0] >= 0 && layout->coordOffsets[1] >= 0 &&
+            layout->coordOffsets[2] >= 0;
+        break;
+    }
+    ply_close(ply);
+
+    // records can't be located directly in ASCII files or with list properties
+    if (layout->mode == PLY_ASCII || layout->stride == 0)
+        offset = -1;
+    layout->offset = offset;
+    return found;
+}
+
+// reads one scalar of a given type from a raw record
+static double decodeScalar(const char *src, e_ply_type type, int reverse)
+{
+    unsigned char raw[8];
+    int size = plyTypeSize(type), i;
+
+    if (reverse)
+        for (i = 0; i < size; i++)
+            raw[i] = src[size - 1 - i];
+    else
+        memcpy(raw, src, size);
+
+    switch (type)
+    {
+        case PLY_INT8: case PLY_CHAR:
+            return *(signed char *) raw;
+        case PLY_UINT8: case PLY_UCHAR:
+            return *(unsigned char *) raw;
+        case PLY_INT16: case PLY_SHORT:
+            return *(short *) raw;
+        case PLY_UINT16: case PLY_USHORT:
+            return *(unsigned short *) raw;
+        case PLY_INT32: case PLY_INT:
+            return *(int *) raw;
+        case PLY_UIN32: case PLY_UINT:
+            return *(unsigned int *) raw;
+        case PLY_FLOAT32: case PLY_FLOAT:
+            return *(float *) raw;
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            return *(double *) raw;
+        default:
+            return 0.0;
+    }
+}
+
+// stores a value as a host order scalar of a given type
+static void storeScalar(char *dst, e_ply_type type, double value)
+{
+    union {
+        signed char i8; unsigned char u8; short i16; unsigned short u16;
+        int i32; unsigned int u32; float f32; double f64;
+    } raw;
+
+    switch (type)
+    {
+        case PLY_INT8: case PLY_CHAR:
+            raw.i8 = (signed char) value;
+            break;
+        case PLY_UINT8: case PLY_UCHAR:
+            raw.u8 = (unsigned char) value;
+            break;
+        case PLY_INT16: case PLY_SHORT:
+            raw.i16 = (short) value;
+            break;
+        case PLY_UINT16: case PLY_USHORT:
+            raw.u16 = (unsigned short) value;
+            break;
+        case PLY_INT32: case PLY_INT:
+            raw.i32 = (int) value;
+            break;
+        case PLY_UIN32: case PLY_UINT:
+            raw.u32 = (unsigned int) value;
+            break;
+        case PLY_FLOAT32: case PLY_FLOAT:
+            raw.f32 = (float) value;
+            break;
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            raw.f64 = value;
+            break;
+        default:
+            return;
+    }
+    memcpy(dst, &raw, plyTypeSize(type));
+}
+
+// prints a host order scalar of a given type preceded by a space
+static int formatScalar(char *dst, const char *src, e_ply_type type)
+{
+    double value = decodeScalar(src, type, 0);
+    switch (type)
+    {
+        case PLY_FLOAT32: case PLY_FLOAT:
+            return sprintf(dst, " %.9g", value);
+        case PLY_FLOAT64: case PLY_DOUBLE:
+            return sprintf(dst, " %.17g", value);
+        case PLY_UIN32: case PLY_UINT:
+            return sprintf(dst, " %u", (unsigned int) value);
+        default:
+            return sprintf(dst, " %d", (int) value);
+    }
+}
+
+// reads a float stored in the opposite byte order
+static float swappedFloat(const char *src)
+{
+    const unsigned char *b = (const unsigned char *) src;
+    unsigned int bits = (unsigned int) b[0] << 24 | (unsigned int) b[1] << 16 |
+        (unsigned int) b[2] << 8 | (unsigned int) b[3];
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+// converts count raw binary vertex records into points
+void decodeVertices(const PlyLayout *layout, const char *records, long count, Point *out)
+{
+    const int *offs = layout->coordOffsets;
+    const e_ply_type *types = layout->coordTypes;
+    long i;
+    int floats = 1;
+
+    for (i = 0; i < 3; i++)
+        floats = floats && (types[i] == PLY_FLOAT32 || types[i] == PLY_FLOAT);
+
+    // float coordinates, the usual case, are copied without conversions
+    if (floats && !layout->reverse) {
+        for (i = 0; i < count; i++, records += layout->stride) {
+            memcpy(&out[i].x, records + offs[0], sizeof(float));
+            memcpy(&out[i].y, records + offs[1], sizeof(float));
+            memcpy(&out[i].z, records + offs[2], sizeof(float));
+        }
+        return;
+    }
+    if (floats) {
+        for (i = 0; i < count; i++, records += layout->stride) {
+            out[i].x = swappedFloat(records + offs[0]);
+            out[i].y = swappedFloat(records + offs[1]);
+            out[i].z = swappedFloat(records + offs[2]);
+        }
+        return;
+    }
+    for (i = 0; i < count; i++, records += layout->stride) {
+        out[i].x = decodeScalar(records + offs[0], types[0], layout->reverse);
+        out[i].y = decodeScalar(records + offs[1], types[1], layout->reverse);
+        out[i].z = decodeScalar(records + offs[2], types[2], layout->reverse);
+    }
+}
+
+// copies the attributes of count raw binary vertex records into attribute records
+void decodeAttributes(const PlyLayout *layout, const char *records, long count, char *attrs)
+{
+    const PlyAttribute *attr;
+    long i;
+    int a, size, b;
+
+    for (i = 0; i < count; i++, records += layout->stride, attrs += layout->attrStride) {
+        for (a = 0; a < layout->nattributes; a++) {
+            attr = &layout->attributes[a];
+            size = plyTypeSize(attr->type);
+            if (!layout->reverse)
+                memcpy(attrs + attr->offset, records + attr->fileOffset, size);
+            else
+                for (b = 0; b < size; b++)
+                    attrs[attr->offset + b] = records[attr->fileOffset + size - 1 - b];
+        }
+    }
+}
+
+// formats the header of an output file with x, y, z float vertices followed by
+// the attributes of layout if it isn't NULL, binary in host byte order or ASCII.
+// Returns its length, which doesn't depend on nvertices
+int formatPlyHeader(char *buffer, long nvertices, int binary, const PlyLayout *layout)
+{
+    const char *format = !binary ? "ascii" :
+        hostIsLittleEndian() ? "binary_little_endian" : "binary_big_endian";
+    int len, a;
+
+    len = sprintf(buffer, "ply\nformat %s 1.0\nelement vertex %-*ld\n"
+        "property float x\nproperty float y\nproperty float z\n",
+        format, PLY_COUNT_WIDTH, nvertices);
+    for (a = 0; layout && a < layout->nattributes; a++)
+        len += sprintf(buffer + len, "property %s %s\n", typeNames[layout->attributes[a].type],
+            layout->attributes[a].name);
+    return len + sprintf(buffer + len, "end_header\n");
+}
+
+// buffers filled by RPly callbacks
+typedef struct CallbackTarget {
+    const PlyLayout *layout;
+    Point *pts;
+    char *attrs;
+} CallbackTarget;
+
+// RPly callback for files without fixed-size vertex records. idata is 0, 1, 2
+// for x, y, z and 3 + a for attribute a
+static int vertexCallback(p_ply_argument argument)
+{
+    CallbackTarget *target;
+    const PlyAttribute *attr;
+    long role, index;
+    ply_get_argument_user_data(argument, (void **) &target, &role);
+    ply_get_argument_element(argument, NULL, &index);
+    switch (role)
+    {
+        case 0:
+            target->pts[index].x = ply_get_argument_value(argument);
+            break;
+        case 1:
+            target->pts[index].y = ply_get_argument_value(argument);
+            break;
+        case 2:
+            target->pts[index].z = ply_get_argument_value(argument);
+            break;
+        default:
+            attr = &target->layout->attributes[role - 3];
+            storeScalar(target->attrs + index * target->layout->attrStride + attr->offset,
+                attr->type, ply_get_argument_value(argument));
+            break;
+    }
+    return 1;
+}
+
+// reading of an ASCII file through RPly callbacks
+static int readPlyCallbacks(const char *filename, const PlyLayout *layout, Point *pts, char *attrs)
+{
+    CallbackTarget target = { layout, pts, attrs };
+    int ok, a;
+    p_ply ply = ply_open(filename, NULL, 0, NULL);
+    if (!ply)
+        return 0;
+    ok = ply_read_header(ply);
+    if (ok) {
+        ply_set_read_cb(ply, "vertex", "x", vertexCallback, &target, 0);
+        ply_set_read_cb(ply, "vertex", "y", vertexCallback, &target, 1);
+        ply_set_read_cb(ply, "vertex", "z", vertexCallback, &target, 2);
+        for (a = 0; a < layout->nattributes; a++)
+            ply_set_read_cb(ply, "vertex", layout->attributes[a].name, vertexCallback, &target, 3 + a);
+        ok = ply_read(ply);
+    }
+    ply_close(ply);
+    return ok;
+}
+
+// locale independent conversion of a decimal number starting at s, *end is set
+// after it. Returns 0 if there is no number there
+static int parseNumber(const char *s, const char *limit, const char **end, double *value)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    unsigned long long mantissa = 0;
+    const char *exp;
+    int negative = 0, digits = 0, exponent = 0, expSign = 1, expValue = 0;
+
+    if (s < limit && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+    // digits beyond the 19th don't change a float, only the magnitude is kept
+    for (; s < limit && *s >= '0' && *s <= '9'; s++, digits++) {
+        if (mantissa < 1000000000000000000ULL)
+            mantissa = mantissa * 10 + (*s - '0');
+        else
+            exponent++;
+    }
+    if (s < limit && *s == '.') {
+        for (s++; s < limit && *s >= '0' && *s <= '9'; s++, digits++) {
+            if (mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa * 10 + (*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (!digits)
+        return 0;
+    if (s < limit && (*s == 'e' || *s == 'E')) {
+        exp = s + 1;
+        if (exp < limit && (*exp == '-' || *exp == '+')) {
+            expSign = *exp == '-' ? -1 : 1;
+            exp++;
+        }
+        if (exp < limit && *exp >= '0' && *exp <= '9') {
+            for (s = exp; s < limit && *s >= '0' && *s <= '9'; s++)
+                if (expValue < 10000)
+                    expValue = expValue * 10 + (*s - '0');
+            exponent += expSign * expValue;
+        }
+    }
+
+    *value = (double) mantissa;
+    if (exponent < 0)
+        *value = exponent >= -22 ? *value / powers[-exponent] : *value * pow(10.0, exponent);
+    else if (exponent > 0)
+        *value = exponent <= 22 ? *value * powers[exponent] : *value * pow(10.0, exponent);
+    if (negative)
+        *value = -*value;
+    *end = s;
+    return 1;
+}
+
+// parses one ASCII vertex line into pt and its attribute record. roles holds
+// 0, 1, 2 for the x, y, z columns, 3 + a for attribute a and -1 for the others.
+// Returns the start of the next line, NULL if the line doesn't have exactly ncolumns numbers
+static const char* parseVertexLine(const PlyLayout *layout, const int *roles, const char *s,
+    const char *limit, Point *pt, char *attr)
+{
+    float coords[3];
+    double value;
+    int column, role;
+
+    for (column = 0; column < layout->ncolumns; column++) {
+        while (s < limit && (*s == ' ' || *s == '\t'))
+            s++;
+        if (!parseNumber(s, limit, &s, &value))
+            return NULL;
+        if (s < limit && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+            return NULL;
+        role = roles[column];
+        if (role >= 3) {
+            if (attr)
+                storeScalar(attr + layout->attributes[role - 3].offset,
+                    layout->attributes[role - 3].type, value);
+        }
+        else if (role >= 0)
+            coords[role] = value;
+    }
+    while (s < limit && (*s == ' ' || *s == '\t' || *s == '\r'))
+        s++;
+    if (s < limit && *s != '\n')
+        return NULL;
+    pt->x = coords[0];
+    pt->y = coords[1];
+    pt->z = coords[2];
+    return s < limit ? s + 1 : s;
+}
+
+// roles of the ASCII columns for parseVertexLine
+static int *columnRoles(const PlyLayout *layout)
+{
+    int *roles = malloc(sizeof(int) * (layout->ncolumns > 0 ? layout->ncolumns : 1));
+    int i;
+
+    for (i = 0; i < layout->ncolumns; i++)
+        roles[i] = -1;
+    for (i = 0; i < 3; i++)
+        roles[layout->coordColumns[i]] = i;
+    for (i = 0; i < layout->nattributes; i++)
+        roles[layout->attributes[i].column] = 3 + i;
+    return roles;
+}
+
+// parallel reading of an ASCII file with one vertex per line. The mapped data is
+// split into line-aligned chunks, lines are counted per chunk and a prefix sum
+// of the counts tells every chunk the index of its first line, so that chunks
+// are parsed in parallel straight into the point and attribute buffers
+static int readPlyAscii(const char *filename, const PlyLayout *layout, Point *pts, char *attrs)
+{
+    struct stat st;
+    const char *map, *data, *s, *limit, *next;
+    long size, nchunks, c, line, lastLine, *starts, *lines;
+    int fd, ok = 1, *roles;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) || st.st_size <= layout->dataOffset) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    data = map + layout->dataOffset;
+    size = st.st_size - layout->dataOffset;
+    nchunks = (size + ASCII_CHUNK - 1) / ASCII_CHUNK;
+    starts = malloc(sizeof(long) * (nchunks + 1));
+    lines = malloc(sizeof(long) * (nchunks + 1));
+    roles = columnRoles(layout);
+
+    // chunk c holds the lines starting in [c * ASCII_CHUNK, (c + 1) * ASCII_CHUNK)
+    #pragma omp parallel for schedule(dynamic) private(s)
+    for (c = 0; c < nchunks; c++) {
+        s = c == 0 ? data : memchr(data + c * ASCII_CHUNK - 1, '\n', size - c * ASCII_CHUNK + 1);
+        starts[c] = c == 0 ? 0 : s ? s + 1 - data : size;
+    }
+    starts[nchunks] = size;
+
+    #pragma omp parallel for schedule(dynamic) private(s, limit)
+    for (c = 0; c < nchunks; c++) {
+        lines[c] = starts[c] < starts[c + 1];
+        limit = data + starts[c + 1] - 1;
+        for (s = data + starts[c]; s < limit && (s = memchr(s, '\n', limit - s)); s++)
+            lines[c]++;
+    }
+    for (c = 0, line = 0; c <= nchunks; c++) {
+        long count = c < nchunks ? lines[c] : 0;
+        lines[c] = line;
+        line += count;
+    }
+    lastLine = layout->skipLines + layout->nvertices;
+    if (line < lastLine)
+        ok = 0;
+
+    #pragma omp parallel for schedule(dynamic) private(s, limit, next, line)
+    for (c = 0; c < nchunks; c++) {
+        s = data + starts[c];
+        limit = data + starts[c + 1];
+        for (line = lines[c]; ok && s < limit && line < lastLine; line++, s = next) {
+            if (line < layout->skipLines) {
+                next = memchr(s, '\n', limit - s);
+                next = next ? next + 1 : limit;
+                continue;
+            }
+            next = parseVertexLine(layout, roles, s, data + size, &pts[line - layout->skipLines],
+                attrs + (line - layout->skipLines) * layout->attrStride);
+            if (!next) {
+                #pragma omp atomic write
+                ok = 0;
+            }
+        }
+    }
+
+    free(starts);
+    free(lines);
+    free(roles);
+    munmap((void *) map, st.st_size);
+    return ok;
+}
+
+// reading of a binary file by large blocks of vertex records
+static int readPlyBinary(const char *filename, const PlyLayout *layout, Point *pts, char *attrs)
+{
+    FILE *file;
+    char *raw;
+    long chunk, done, n;
+    int ok = 1;
+
+    file = fopen(filename, "rb");
+    if (!file)
+        return 0;
+    chunk = READ_BLOCK / layout->stride;
+    if (chunk < 1)
+        chunk = 1;
+    raw = malloc(chunk * layout->stride);
+
+    if (fseek(file, layout->offset, SEEK_SET))
+        ok = 0;
+    for (done = 0; ok && done < layout->nvertices; done += n) {
+        n = layout->nvertices - done;
+        if (n > chunk)
+            n = chunk;
+        if (fread(raw, layout->stride, n, file) != (size_t) n)
+            ok = 0;
+        else {
+            decodeVertices(layout, raw, n, pts + done);
+            if (attrs)
+                decodeAttributes(layout, raw, n, attrs + done * layout->attrStride);
+        }
+    }
+    free(raw);
+    fclose(file);
+    return ok;
+}
+
+// can the vertex records be used as points without any conversion?
+static int matchesPoint(const PlyLayout *layout)
+{
+    int i;
+    if (layout->reverse || layout->stride != sizeof(Point) || sizeof(Point) != 3 * sizeof(float) ||
+            layout->offset % sizeof(float) != 0)
+        return 0;
+    for (i = 0; i < 3; i++)
+        if (layout->coordOffsets[i] != i * (int) sizeof(float) ||
+                (layout->coordTypes[i] != PLY_FLOAT32 && layout->coordTypes[i] != PLY_FLOAT))
+            return 0;
+    return 1;
+}
+
+// makes the point and attribute buffers of a cloud large enough for n vertices,
+// they only grow so that clouds reloaded with other files reuse them
+void reserveCloud(PlyCloud *cloud, long n)
+{
+    long attrBytes = (long) cloud->layout.attrStride * n;
+
+    if (n < 1)
+        n = 1;
+    if (n > cloud->capacity) {
+        countFree(ALLOC_POINTS, (long) sizeof(Point) * cloud->capacity);
+        free(cloud->buffer);
+        cloud->buffer = malloc(sizeof(Point) * n);
+        cloud->capacity = n;
+        countAlloc(ALLOC_POINTS, (long) sizeof(Point) * n);
+    }
+    if (attrBytes > cloud->attrCapacity) {
+        countFree(ALLOC_ATTRIBUTES, cloud->attrCapacity);
+        free(cloud->attributes);
+        cloud->attributes = malloc(attrBytes);
+        cloud->attrCapacity = attrBytes;
+        countAlloc(ALLOC_ATTRIBUTES, attrBytes);
+    }
+    cloud->points = cloud->buffer;
+}
+
+// mapping of a binary file: the vertex block becomes the point buffer if its
+// records match Point, otherwise it is converted from the mapping in one pass.
+// Pages are private, so noise may be added to mapped points
+static int readPlyMapped(const char *filename, const PlyLayout *layout, PlyCloud *cloud)
+{
+    struct stat st;
+    char *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) || st.st_size < layout->offset + layout->nvertices * layout->stride ||
+            st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    if (matchesPoint(layout)) {
+        cloud->points = (Point *) (map + layout->offset);
+        cloud->map = map;
+        cloud->mapSize = st.st_size;
+        countAlloc(ALLOC_POINTS, cloud->mapSize);
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    reserveCloud(cloud, layout->nvertices);
+    decodeVertices(layout, map + layout->offset, layout->nvertices, cloud->points);
+    if (cloud->attributes)
+        decodeAttributes(layout, map + layout->offset, layout->nvertices, cloud->attributes);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+// reads x, y, z and the scalar attributes of all vertices of a PLY file.
+// Returns 1 on success
+int readPly(const char *filename, PlyCloud *cloud)
+{
+    memset(cloud, 0, sizeof(PlyCloud));
+    if (!reloadPly(filename, cloud)) {
+        freePlyCloud(cloud);
+        return 0;
+    }
+    return 1;
+}
+
+// reads another file into a cloud returned by readPly or reloadPly, reusing
+// its buffers. A cloud filled with zeros may be reloaded too
+int reloadPly(const char *filename, PlyCloud *cloud)
+{
+    PlyLayout *layout = &cloud->layout;
+    int ok;
+
+    if (cloud->map) {
+        munmap(cloud->map, cloud->mapSize);
+        countFree(ALLOC_POINTS, cloud->mapSize);
+    }
+    cloud->map = NULL;
+    cloud->mapSize = 0;
+    cloud->points = NULL;
+    cloud->size = 0;
+    if (isPackedFile(filename))
+        return readPacked(filename, cloud);
+    if (!readPlyLayout(filename, layout))
+        return 0;
+    cloud->size = layout->nvertices;
+    if (layout->offset >= 0 && readPlyMapped(filename, layout, cloud))
+        return 1;
+
+    // files which can't be mapped are read through stdio
+    reserveCloud(cloud, layout->nvertices);
+    if (layout->offset >= 0)
+        ok = readPlyBinary(filename, layout, cloud->points, cloud->attributes);
+    else {
+        // ASCII lines which don't parse as plain numbers are left to RPly
+        ok = layout->mode == PLY_ASCII && layout->ncolumns > 0 &&
+            readPlyAscii(filename, layout, cloud->points, cloud->attributes);
+        if (!ok)
+            ok = readPlyCallbacks(filename, layout, cloud->points, cloud->attributes);
+    }
+    if (!ok) {
+        cloud->points = NULL;
+        cloud->size = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// releasing points returned by readPly
+void freePlyCloud(PlyCloud *cloud)
+{
+    if (cloud->map) {
+        munmap(cloud->map, cloud->mapSize);
+        countFree(ALLOC_POINTS, cloud->mapSize);
+    }
+    free(cloud->buffer);
+    free(cloud->attributes);
+    countFree(ALLOC_POINTS, (long) sizeof(Point) * cloud->capacity);
+    countFree(ALLOC_ATTRIBUTES, cloud->attrCapacity);
+    memset(cloud, 0, sizeof(PlyCloud));
+}
+
+// opens a file for reading its vertices block by block, the whole cloud is never
+// held in memory. Needs fixed-size binary records, plain ASCII vertex lines or
+// a container, whose blocks are decoded one at a time
+int openPlyReader(const char *filename, PlyReader *reader)
+{
+    PlyLayout *layout = &reader->layout;
+    long i;
+    int ok;
+
+    memset(reader, 0, sizeof(PlyReader));
+    if (isPackedFile(filename)) {
+        if (!readPackedLayout(filename, layout, &reader->nblocks))
+            return 0;
+        reader->packed = strdup(filename);
+        reader->blockPoints = malloc(sizeof(Point) * PACK_BLOCK);
+        if (layout->nattributes)
+            reader->blockAttrs = malloc((size_t) layout->attrStride * PACK_BLOCK);
+        return 1;
+    }
+    if (!readPlyLayout(filename, layout))
+        return 0;
+    if (layout->offset < 0 && (layout->mode != PLY_ASCII || layout->ncolumns == 0))
+        return 0;
+    reader->file = fopen(filename, "rb");
+    if (!reader->file)
+        return 0;
+    if (layout->offset >= 0)
+        ok = !fseek(reader->file, layout->offset, SEEK_SET);
+    else {
+        reader->roles = columnRoles(layout);
+        ok = !fseek(reader->file, layout->dataOffset, SEEK_SET);
+        for (i = 0; ok && i < layout->skipLines; i++)
+            ok = getline(&reader->line, &reader->lineSize, reader->file) > 0;
+    }
+    if (!ok) {
+        closePlyReader(reader);
+        return 0;
+    }
+    return 1;
+}
+
+// reads up to max next vertices into pts and, with attributes, into attrs.
+// Returns the number of vertices read, 0 at the end and -1 on errors
+long readPlyBlock(PlyReader *reader, Point *pts, char *attrs, long max)
+{
+    const PlyLayout *layout = &reader->layout;
+    const char *next;
+    ssize_t len;
+    long n = layout->nvertices - reader->done, i, m;
+
+    if (n > max)
+        n = max;
+    if (n <= 0)
+        return 0;
+    if (reader->packed) {
+        for (i = 0; i < n; i += m) {
+            if (reader->blockDone == reader->blockSize) {
+                if (reader->block == reader->nblocks)
+                    return -1;
+                reader->blockSize = readPackedBlock(reader->packed, reader->block++, reader->blockPoints,
+                    reader->blockAttrs);
+                reader->blockDone = 0;
+                if (reader->blockSize < 0)
+                    return -1;
+            }
+            m = n - i < reader->blockSize - reader->blockDone ? n - i : reader->blockSize - reader->blockDone;
+            memcpy(pts + i, reader->blockPoints + reader->blockDone, sizeof(Point) * m);
+            if (attrs && layout->nattributes > 0)
+                memcpy(attrs + i * layout->attrStride, reader->blockAttrs + reader->blockDone * layout->attrStride,
+                    (size_t) layout->attrStride * m);
+            reader->blockDone += m;
+        }
+    }
+    else if (layout->offset >= 0) {
+        if (n * layout->stride > reader->rawSize) {
+            free(reader->raw);
+            reader->rawSize = n * layout->stride;
+            reader->raw = malloc(reader->rawSize);
+        }
+        if (fread(reader->raw, layout->stride, n, reader->file) != (size_t) n)
+            return -1;
+        decodeVertices(layout, reader->raw, n, pts);
+        if (attrs && layout->nattributes > 0)
+            decodeAttributes(layout, reader->raw, n, attrs);
+    }
+    else {
+        for (i = 0; i < n; i++) {
+            len = getline(&reader->line, &reader->lineSize, reader->file);
+            if (len <= 0)
+                return -1;
+            next = parseVertexLine(layout, reader->roles, reader->line, reader->line + len, &pts[i],
+                attrs ? attrs + i * layout->attrStride : NULL);
+            if (!next)
+                return -1;
+        }
+    }
+    reader->done += n;
+    return n;
+}
+
+void closePlyReader(PlyReader *reader)
+{
+    if (reader->file)
+        fclose(reader->file);
+    free(reader->raw);
+    free(reader->line);
+    free(reader->roles);
+    free(reader->packed);
+    free(reader->blockPoints);
+    free(reader->blockAttrs);
+    memset(reader, 0, sizeof(PlyReader));
+}
+
+// creates an output file whose points are appended with writePlyPoints. Its
+// header is written with a zero count and patched by closePlyWriter. Attributes
+// of layout are written after x, y, z, layout may be NULL
+int openPlyWriter(const char *filename, PlyWriter *writer, int binary, const PlyLayout *layout)
+{
+    char header[PLY_HEADER_MAX];
+    int len;
+
+    memset(writer, 0, sizeof(PlyWriter));
+    writer->binary = binary;
+    writer->layout = layout && layout->nattributes > 0 ? layout : NULL;
+    writer->recordSize = sizeof(Point) + (writer->layout ? layout->attrStride : 0);
+    writer->file = fopen(filename, binary ? "wb" : "w");
+    if (!writer->file)
+        return 0;
+    len = formatPlyHeader(header, 0, binary, writer->layout);
+    writer->ok = fwrite(header, 1, len, writer->file) == (size_t) len;
+    writer->block = malloc((size_t) writer->recordSize * WRITE_BLOCK);
+    if (!binary)
+        writer->text = malloc(WRITE_BLOCK *
+            (ASCII_LINE_MAX + (writer->layout ? layout->nattributes : 0) * ASCII_VALUE_MAX));
+    countAlloc(ALLOC_OUTPUT, plyWriterBytes(binary, writer->layout));
+    return writer->ok;
+}
+
+// bytes of the buffers of a writer opened with the same arguments
+long plyWriterBytes(int binary, const PlyLayout *layout)
+{
+    int nattributes = layout ? layout->nattributes : 0;
+    long bytes = (long) (sizeof(Point) + (nattributes > 0 ? layout->attrStride : 0)) * WRITE_BLOCK;
+
+    if (!binary)
+        bytes += (long) WRITE_BLOCK * (ASCII_LINE_MAX + nattributes * ASCII_VALUE_MAX);
+    return bytes;
+}
+
+// appends points pts[inds[i]] for i < size, each followed by its record of attrs,
+// or the first size points if inds is NULL (a compacted cloud). Points and records
+// are gathered by blocks, so that no copy of the whole result is needed
+int writePlyPoints(PlyWriter *writer, const Point *pts, const char *attrs, const PointIndex *inds, long size)
+{
+    const PlyLayout *layout = writer->layout;
+    int attrStride = layout && attrs ? layout->attrStride : 0;
+    int recordSize = writer->recordSize, len, a;
+    char *record;
+    Point pt;
+    long done, n, i, index;
+
+    for (done = 0; writer->ok && done < size; done += n) {
+        n = size - done;
+        if (n > WRITE_BLOCK)
+            n = WRITE_BLOCK;
+        for (i = 0, record = writer->block; i < n; i++, record += recordSize) {
+            index = inds ? inds[done + i] : done + i;
+            memcpy(record, &pts[index], sizeof(Point));
+            if (attrStride)
+                memcpy(record + sizeof(Point), attrs + (size_t) index * attrStride, attrStride);
+            else if (layout)
+                memset(record + sizeof(Point), 0, layout->attrStride);
+        }
+        if (writer->binary) {
+            writer->ok = fwrite(writer->block, recordSize, n, writer->file) == (size_t) n;
+            continue;
+        }
+        len = 0;
+        for (i = 0, record = writer->block; i < n; i++, record += recordSize) {
+            memcpy(&pt, record, sizeof(Point));
+            len += sprintf(writer->text + len, "%.6f %.6f %.6f", pt.x, pt.y, pt.z);
+            for (a = 0; layout && a < layout->nattributes; a++)
+                len += formatScalar(writer->text + len, record + sizeof(Point) + layout->attributes[a].offset,
+                    layout->attributes[a].type);
+            writer->text[len++] = '\n';
+        }
+        writer->ok = fwrite(writer->text, 1, len, writer->file) == (size_t) len;
+    }
+    if (writer->ok)
+        writer->count += size;
+    return writer->ok;
+}
+
+// writes the final count into the header and closes the file. Returns 1 if
+// everything was written
+int closePlyWriter(PlyWriter *writer)
+{
+    char header[PLY_HEADER_MAX];
+    int len, ok = writer->ok;
+
+    if (!writer->file)
+        return 0;
+    len = formatPlyHeader(header, writer->count, writer->binary, writer->layout);
+    if (ok)
+        ok = !fseek(writer->file, 0, SEEK_SET) && fwrite(header, 1, len, writer->file) == (size_t) len;
+    if (fclose(writer->file))
+        ok = 0;
+    free(writer->block);
+    free(writer->text);
+    countFree(ALLOC_OUTPUT, plyWriterBytes(writer->binary, writer->layout));
+    memset(writer, 0, sizeof(PlyWriter));
+    return ok;
+}
+
+// writes points pts[inds[i]] for i < size of a cloud into a new PLY file, each
+// followed by its attribute record, or its first size points if inds is NULL.
+// Returns 1 on success
+int writePly(const char *filename, const PlyCloud *cloud, PointIndex *inds, long size, int binary)
+{
+    PlyWriter writer;
+    int ok;
+
+    ok = openPlyWriter(filename, &writer, binary, &cloud->layout);
+    if (ok)
+        ok = writePlyPoints(&writer, cloud->points, cloud->attributes, inds, size);
+    return closePlyWriter(&writer) && ok;
+}
@@ -0,0 +1,124 @@
+#ifndef PLY_IO_H
+#define PLY_IO_H
+
+#include <stdio.h>
+
+#include "rply.h"
+#include "my_octree.h"
+
+// vertex properties other than x, y, z are kept as raw records of their
+// scalar values in host byte order, one fixed-size record per point
+#define PLY_MAX_ATTRIBUTES 16
+#define PLY_NAME_MAX 64
+
+typedef struct PlyAttribute {
+    char name[PLY_NAME_MAX];
+    e_ply_type type;
+    int offset;                 // byte offset inside an attribute record
+    int fileOffset;             // byte offset inside a binary vertex record
+    int column;                 // ASCII column
+} PlyAttribute;
+
+// binary layout of the vertex element of a PLY file
+
+typedef struct PlyLayout {
+    e_ply_storage_mode mode;
+    long nvertices;
+    long offset;                // byte offset of the first vertex record
+    int stride;                 // size of one vertex record in bytes
+    int coordOffsets[3];        // byte offsets of x, y, z inside a record
+    e_ply_type coordTypes[3];
+    int reverse;                // file byte order differs from the host one
+    long dataOffset;            // byte offset of the data section
+    long skipLines;             // ASCII lines of the elements preceding vertices
+    int ncolumns;               // ASCII values per vertex line, 0 with list properties
+    int coordColumns[3];        // ASCII columns of x, y, z
+    int nattributes;
+    int attrStride;             // size of one attribute record in bytes
+    int dropped;                // list properties and those beyond PLY_MAX_ATTRIBUTES
+    PlyAttribute attributes[PLY_MAX_ATTRIBUTES];
+} PlyLayout;
+
+int plyTypeSize(e_ply_type);
+
+// header parsing and decoding of raw vertex records
+
+int readPlyLayout(const char *, PlyLayout *);
+void decodeVertices(const PlyLayout *, const char *, long, Point *);
+void decodeAttributes(const PlyLayout *, const char *, long, char *);
+
+// vertices of a whole file. Files with exactly x, y, z floats in host byte order
+// are mapped and used in place, others are converted into allocated memory
+
+typedef struct PlyCloud {
+    Point *points;
+    long size;
+    void *map;       // mapping of the file if points are used in place, NULL otherwise
+    size_t mapSize;
+    char *attributes; // layout.attrStride bytes per point
+    PlyLayout layout;
+    Point *buffer;   // allocated points, kept for the next file by reloadPly
+    long capacity;
+    long attrCapacity;
+} PlyCloud;
+
+int readPly(const char *, PlyCloud *);
+int reloadPly(const char *, PlyCloud *);
+void reserveCloud(PlyCloud *, long);
+void freePlyCloud(PlyCloud *);
+
+// headers of written files have a fixed length whatever the number of points is,
+// so that the records can be placed before the count is known
+#define PLY_COUNT_WIDTH 20
+#define PLY_HEADER_MAX (256 + PLY_MAX_ATTRIBUTES * (PLY_NAME_MAX + 20))
+
+int formatPlyHeader(char *, long, int, const PlyLayout *);
+
+// writing of the points with given indexes and their attributes, binary in
+// host byte order or ASCII
+int writePly(const char *, const PlyCloud *, PointIndex *, long, int);
+
+// streaming reading of the vertices of a file or of a container by blocks
+
+typedef struct PlyReader {
+    PlyLayout layout;
+    FILE *file;
+    long done;          // vertices read so far
+    char *raw;          // binary records of one block
+    long rawSize;
+    char *line;         // current ASCII line
+    size_t lineSize;
+    int *roles;         // ASCII columns roles
+    char *packed;       // name of a container read block by block, NULL for PLY files
+    long nblocks;       // of the container
+    long block;         // next one to decode
+    Point *blockPoints; // decoded points of the current block and their attributes
+    char *blockAttrs;
+    long blockSize;     // points of the current block
+    long blockDone;     // handed out so far
+} PlyReader;
+
+int openPlyReader(const char *, PlyReader *);
+long readPlyBlock(PlyReader *, Point *, char *, long);
+void closePlyReader(PlyReader *);
+
+// output file written by appending points, its count is patched in the header
+// when it is closed
+
+typedef struct PlyWriter {
+    FILE *file;
+    int binary;
+    const PlyLayout *layout;    // attributes written after x, y, z, NULL without them
+    int recordSize;
+    long count;
+    int ok;
+    char *block;
+    char *text;
+} PlyWriter;
+
+int openPlyWriter(const char *, PlyWriter *, int, const PlyLayout *);
+int writePlyPoints(PlyWriter *, const Point *, const char *, const PointIndex *, long);
+int closePlyWriter(PlyWriter *);
+long plyWriterBytes(int, const PlyLayout *);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+
+#include "queue.h"
+#include "trace.h"
+
+void initQueue(Queue *queue, int capacity)
+{
+    queue->items = malloc(sizeof(void *) * capacity);
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+}
+
+void destroyQueue(Queue *queue)
+{
+    free(queue->items);
+    queue->items = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+}
+
+// appends an item, waiting for a free place. Waits are traced as spans
+void pushQueue(Queue *queue, void *item)
+{
+    double span = traceBegin();
+    int waited = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+        waited = 1;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    if (waited)
+        traceEnd("wait for space", span);
+}
+
+// removes the oldest item, waiting for one. Returns NULL once the queue
+// is closed and empty
+void *popQueue(Queue *queue)
+{
+    void *item = NULL;
+    double span = traceBegin();
+    int waited = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+        waited = 1;
+    }
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->notFull);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    if (waited)
+        traceEnd("wait for item", span);
+    return item;
+}
+
+// wakes up the consumers waiting for items which won't come
+void closeQueue(Queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,27 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+
+// bounded blocking queue of pointers connecting pipeline stages run by
+// different threads. Producers wait while it is full, consumers while it is empty
+
+typedef struct Queue {
+    void **items;
+    int capacity;
+    int head;
+    int count;
+    int closed;     // no more items will be pushed
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} Queue;
+
+void initQueue(Queue *, int);
+void destroyQueue(Queue *);
+
+void pushQueue(Queue *, void *);
+void *popQueue(Queue *);
+void closeQueue(Queue *);
+
+#endif
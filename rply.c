@@ -754,6 +754,19 @@ int ply_get_property_info(p_ply_property property, const char** name,
 
 }
 
+e_ply_storage_mode ply_get_storage_mode(p_ply ply) {
+    assert(ply);
+    return ply->storage_mode;
+}
+
+long ply_get_data_offset(p_ply ply) {
+    long position;
+    assert(ply && ply->fp && ply->io_mode == PLY_READ);
+    position = ftell(ply->fp);
+    if (position < 0) return -1;
+    return position - (long) BSIZE(ply);
+}
+
 const char *ply_get_next_comment(p_ply ply, const char *last) {
     assert(ply);
     if (!last) return ply->comment;
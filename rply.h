@@ -234,6 +234,25 @@ p_ply_property ply_get_next_property(p_ply_element element,
 int ply_get_property_info(p_ply_property property, const char** name,
         e_ply_type *type, e_ply_type *length_type, e_ply_type *value_type);
 
+/* ----------------------------------------------------------------------
+ * Returns the storage mode of a file opened by ply_open
+ *
+ * ply: handle returned by ply_open
+ *
+ * Returns the storage mode read from the header
+ * ---------------------------------------------------------------------- */
+e_ply_storage_mode ply_get_storage_mode(p_ply ply);
+
+/* ----------------------------------------------------------------------
+ * Returns the position of the first data byte of a file, i.e. the size
+ * of its header. Only meaningful right after ply_read_header.
+ *
+ * ply: handle returned by ply_open
+ *
+ * Returns the byte offset of the data section, -1 on error
+ * ---------------------------------------------------------------------- */
+long ply_get_data_offset(p_ply ply);
+
 /* ----------------------------------------------------------------------
  * Creates new PLY file
  *
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "synth.h"
+
+#define BLOB_COUNT 32
+#define BLOB_SIGMA 2.5f
+#define FACADE_HEIGHT 20.0f
+#define STREET_WIDTH 30.0f
+#define SCAN_RINGS 64
+#define SCAN_SECTORS 360 // azimuth sectors with their own obstacle range
+#define SCAN_HEIGHT 2.0f // sensor above the ground
+#define SCAN_RANGE 70.0f
+#define DUPLICATES 16 // copies of every point of the duplicates cloud
+
+const char *synthNames[] = { "uniform", "blobs", "facades", "scan", "duplicates", NULL };
+
+// splitmix64, the same sequence on every platform unlike rand()
+static unsigned long nextRandom(unsigned long *state)
+{
+    unsigned long z = (*state += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static float uniform(unsigned long *state)
+{
+    return (nextRandom(state) >> 40) / (float) (1UL << 24);
+}
+
+static float gaussian(unsigned long *state)
+{
+    float u = uniform(state), v = uniform(state);
+    return sqrtf(-2.0f * logf(1.0f - u)) * cosf(2.0f * (float) M_PI * v);
+}
+
+static void uniformCube(long n, unsigned long *state, Point *pts)
+{
+    long i;
+    for (i = 0; i < n; i++) {
+        pts[i].x = SYNTH_EXTENT * uniform(state);
+        pts[i].y = SYNTH_EXTENT * uniform(state);
+        pts[i].z = SYNTH_EXTENT * uniform(state);
+    }
+}
+
+// gaussian blobs around centers spread over the cube
+static void blobs(long n, unsigned long *state, Point *pts)
+{
+    Point centers[BLOB_COUNT];
+    long i;
+    int b;
+
+    uniformCube(BLOB_COUNT, state, centers);
+    for (i = 0; i < n; i++) {
+        b = nextRandom(state) % BLOB_COUNT;
+        pts[i].x = centers[b].x + BLOB_SIGMA * gaussian(state);
+        pts[i].y = centers[b].y + BLOB_SIGMA * gaussian(state);
+        pts[i].z = centers[b].z + BLOB_SIGMA * gaussian(state);
+    }
+}
+
+// two rows of walls along a street and the ground between them, with a few
+// centimeters of measurement noise
+static void facades(long n, unsigned long *state, Point *pts)
+{
+    float u;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        u = uniform(state);
+        pts[i].x = SYNTH_EXTENT * uniform(state);
+        if (u < 0.8f) {
+            pts[i].y = u < 0.4f ? 0.0f : STREET_WIDTH;
+            pts[i].z = FACADE_HEIGHT * uniform(state);
+        }
+        else {
+            pts[i].y = STREET_WIDTH * uniform(state);
+            pts[i].z = 0.0f;
+        }
+        pts[i].x += 0.02f * gaussian(state);
+        pts[i].y += 0.02f * gaussian(state);
+        pts[i].z += 0.02f * gaussian(state);
+    }
+}
+
+// rotating scanner in the middle of the cube: rings of beams hit the ground or
+// an obstacle at a range depending on the azimuth, so density falls with range
+static void scan(long n, unsigned long *state, Point *pts)
+{
+    float obstacles[SCAN_SECTORS], elevation, azimuth, range, dx, dy, dz;
+    long perRing = (n + SCAN_RINGS - 1) / SCAN_RINGS, i;
+    int s;
+
+    for (s = 0; s < SCAN_SECTORS; s++)
+        obstacles[s] = 15.0f + (SCAN_RANGE - 15.0f) * uniform(state);
+    for (i = 0; i < n; i++) {
+        elevation = (-25.0f + 28.0f * (i / perRing) / (SCAN_RINGS - 1)) * (float) M_PI / 180.0f;
+        azimuth = 2.0f * (float) M_PI * (i % perRing) / perRing;
+        dx = cosf(elevation) * cosf(azimuth);
+        dy = cosf(elevation) * sinf(azimuth);
+        dz = sinf(elevation);
+        range = obstacles[(int) (azimuth / (2.0f * (float) M_PI) * SCAN_SECTORS) % SCAN_SECTORS];
+        if (dz < 0.0f && SCAN_HEIGHT / -dz < range)
+            range = SCAN_HEIGHT / -dz;
+        range += 0.02f * gaussian(state);
+        pts[i].x = 0.5f * SYNTH_EXTENT + range * dx;
+        pts[i].y = 0.5f * SYNTH_EXTENT + range * dy;
+        pts[i].z = SCAN_HEIGHT + range * dz;
+    }
+}
+
+// every position repeated DUPLICATES times, copies scattered over the array
+static void duplicates(long n, unsigned long *state, Point *pts)
+{
+    long distinct = (n + DUPLICATES - 1) / DUPLICATES, i;
+    Point *base = malloc(sizeof(Point) * distinct);
+
+    uniformCube(distinct, state, base);
+    for (i = 0; i < n; i++)
+        pts[i] = base[(i * 7919) % distinct];
+    free(base);
+}
+
+// fills pts with n points of a named generator. Returns 0 for unknown names
+int generateCloud(const char *name, long n, unsigned long seed, Point *pts)
+{
+    unsigned long state = seed ^ (unsigned long) n * 0x2545f4914f6cdd1dUL;
+
+    if (!strcmp(name, "uniform"))
+        uniformCube(n, &state, pts);
+    else if (!strcmp(name, "blobs"))
+        blobs(n, &state, pts);
+    else if (!strcmp(name, "facades"))
+        facades(n, &state, pts);
+    else if (!strcmp(name, "scan"))
+        scan(n, &state, pts);
+    else if (!strcmp(name, "duplicates"))
+        duplicates(n, &state, pts);
+    else
+        return 0;
+    return 1;
+}
+
+// typical distance between neighboring points of a generated cloud, from the
+// volume or the area its points fill, so that search radii scale with the size
+float synthSpacing(const char *name, long n)
+{
+    if (!strcmp(name, "blobs"))
+        return cbrtf(BLOB_COUNT * 125.0f * BLOB_SIGMA * BLOB_SIGMA * BLOB_SIGMA / n);
+    if (!strcmp(name, "facades"))
+        return sqrtf((2.0f * FACADE_HEIGHT + STREET_WIDTH) * SYNTH_EXTENT / n);
+    if (!strcmp(name, "scan"))
+        return sqrtf((float) M_PI * 30.0f * 30.0f / n);
+    if (!strcmp(name, "duplicates"))
+        return SYNTH_EXTENT / cbrtf((float) n / DUPLICATES);
+    return SYNTH_EXTENT / cbrtf((float) n);
+}
@@ -0,0 +1,17 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "my_octree.h"
+
+// deterministic synthetic clouds for benchmarks: the same name, size and seed
+// always give the same points. Clouds span about 100 units
+
+#define SYNTH_EXTENT 100.0f
+
+// generator names, NULL-terminated
+extern const char *synthNames[];
+
+int generateCloud(const char *, long, unsigned long, Point *);
+float synthSpacing(const char *, long);
+
+#endif
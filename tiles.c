@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+
+#include "tiles.h"
+#include "queue.h"
+#include "trace.h"
+
+#define TILE_READ_BLOCK (64 * 1024) // input points binned at once
+#define TILE_CHUNK 64 // points handed to a thread at once
+#define SOR_HALO 0.25f // first SOR halo relative to the tile size
+#define PIPELINE_DEPTH 3 // tiles in flight: one loaded, one filtered, one written
+
+// a tile is a cube of the grid, its points are kept in files named after its id:
+// .core for its own points, .halo for the points of its neighbors within the
+// halo and .mean for SOR mean distances of the core points
+
+typedef struct Tile {
+    int cell[3];
+    long id;        // -1 for free slots of the table
+    long ncore;
+    long nhalo;
+} Tile;
+
+typedef struct TileSet {
+    Tile *slots;    // hash table of the tiles by cell
+    long capacity;
+    long ntiles;
+    float size;
+    float halo;     // width of the halo written while binning
+    float lo[3], hi[3]; // bounding box of the cloud
+    int recordSize; // point followed by its attributes
+    char dir[4096];
+} TileSet;
+
+// points of one tile and of its halo, core points first
+typedef struct TilePoints {
+    Point *pts;
+    char *attrs;
+    long size;
+    long capacity;
+} TilePoints;
+
+typedef struct BinEntry {
+    long key;       // 2 * tile id, + 1 for halo copies
+    int index;      // point of the input block
+} BinEntry;
+
+static void tilePath(const TileSet *set, long id, const char *kind, char *path)
+{
+    sprintf(path, "%s/%ld.%s", set->dir, id, kind);
+}
+
+static unsigned long hashCell(const int *cell)
+{
+    return (unsigned long) cell[0] * 73856093UL ^ (unsigned long) cell[1] * 19349663UL ^
+        (unsigned long) cell[2] * 83492791UL;
+}
+
+static Tile *findTile(const TileSet *set, const int *cell)
+{
+    unsigned long i = hashCell(cell) % set->capacity;
+    for (; set->slots[i].id >= 0; i = (i + 1) % set->capacity)
+        if (!memcmp(set->slots[i].cell, cell, sizeof(int) * 3))
+            return &set->slots[i];
+    return NULL;
+}
+
+// tile of a cell, created if it isn't known yet
+static Tile *getTile(TileSet *set, const int *cell)
+{
+    Tile *old = set->slots, *tile;
+    unsigned long i;
+    long j;
+
+    tile = findTile(set, cell);
+    if (tile)
+        return tile;
+    // the table is kept at most half full
+    if (2 * (set->ntiles + 1) > set->capacity) {
+        set->capacity *= 2;
+        set->slots = malloc(sizeof(Tile) * set->capacity);
+        for (j = 0; j < set->capacity; j++)
+            set->slots[j].id = -1;
+        for (j = 0; j < set->capacity / 2; j++) {
+            if (old[j].id < 0)
+                continue;
+            for (i = hashCell(old[j].cell) % set->capacity; set->slots[i].id >= 0; i = (i + 1) % set->capacity)
+                ;
+            set->slots[i] = old[j];
+        }
+        free(old);
+    }
+    for (i = hashCell(cell) % set->capacity; set->slots[i].id >= 0; i = (i + 1) % set->capacity)
+        ;
+    tile = &set->slots[i];
+    memcpy(tile->cell, cell, sizeof(int) * 3);
+    tile->id = set->ntiles++;
+    tile->ncore = 0;
+    tile->nhalo = 0;
+    return tile;
+}
+
+static void cellOf(const TileSet *set, Point p, int *cell)
+{
+    cell[0] = (int) floorf(p.x / set->size);
+    cell[1] = (int) floorf(p.y / set->size);
+    cell[2] = (int) floorf(p.z / set->size);
+}
+
+static int binComp(const void *a, const void *b)
+{
+    const BinEntry *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->index - y->index;
+}
+
+// appends records to a file of a tile
+static int appendRecords(const char *path, const char *records, long count, int recordSize)
+{
+    FILE *file = fopen(path, "ab");
+    int ok;
+    if (!file)
+        return 0;
+    ok = fwrite(records, recordSize, count, file) == (size_t) count;
+    if (fclose(file))
+        ok = 0;
+    return ok;
+}
+
+// first pass: every point is appended to its own tile and to the halo of the
+// neighbors whose cube grown by the halo width contains it. Entries of a block
+// are grouped by tile, so that every tile file is opened once per block
+static int binCloud(TileSet *set, PlyReader *reader, float noiseProb, long *total)
+{
+    const PlyLayout *layout = &reader->layout;
+    Point *pts = malloc(sizeof(Point) * TILE_READ_BLOCK);
+    char *attrs = layout->nattributes ? malloc((size_t) layout->attrStride * TILE_READ_BLOCK) : NULL;
+    char *records = malloc((size_t) set->recordSize * TILE_READ_BLOCK);
+    BinEntry *entries = malloc(sizeof(BinEntry) * 27 * TILE_READ_BLOCK);
+    char path[4200];
+    Tile *tile;
+    long n, nentries, e, run, i;
+    int cell[3], neighbor[3], near[3][3], dx, dy, dz, c, ok = 1;
+    float lo, coords[3];
+
+    for (c = 0; c < 3; c++) {
+        set->lo[c] = FLT_MAX;
+        set->hi[c] = -FLT_MAX;
+    }
+    while (ok && (n = readPlyBlock(reader, pts, attrs, TILE_READ_BLOCK)) > 0) {
+        if (noiseProb) {
+            for (i = 0; i < n; i++) {
+                if ((double)rand() / (double)RAND_MAX < noiseProb) {
+                    pts[i].x += AWGN_generator();
+                    pts[i].y += AWGN_generator();
+                    pts[i].z += AWGN_generator();
+                }
+            }
+        }
+
+        nentries = 0;
+        for (i = 0; i < n; i++) {
+            coords[0] = pts[i].x;
+            coords[1] = pts[i].y;
+            coords[2] = pts[i].z;
+            cellOf(set, pts[i], cell);
+            for (c = 0; c < 3; c++) {
+                set->lo[c] = coords[c] < set->lo[c] ? coords[c] : set->lo[c];
+                set->hi[c] = coords[c] > set->hi[c] ? coords[c] : set->hi[c];
+                // near[c] tells which neighbors along axis c get a halo copy
+                lo = cell[c] * set->size;
+                near[c][0] = coords[c] - lo <= set->halo;
+                near[c][1] = 1;
+                near[c][2] = lo + set->size - coords[c] <= set->halo;
+            }
+            tile = getTile(set, cell);
+            tile->ncore++;
+            entries[nentries].key = 2 * tile->id;
+            entries[nentries++].index = i;
+            for (dx = -1; dx <= 1; dx++)
+                for (dy = -1; dy <= 1; dy++)
+                    for (dz = -1; dz <= 1; dz++) {
+                        if ((!dx && !dy && !dz) || !near[0][dx + 1] || !near[1][dy + 1] || !near[2][dz + 1])
+                            continue;
+                        neighbor[0] = cell[0] + dx;
+                        neighbor[1] = cell[1] + dy;
+                        neighbor[2] = cell[2] + dz;
+                        tile = getTile(set, neighbor);
+                        tile->nhalo++;
+                        entries[nentries].key = 2 * tile->id + 1;
+                        entries[nentries++].index = i;
+                    }
+        }
+
+        qsort(entries, nentries, sizeof(BinEntry), binComp);
+        for (e = 0; ok && e < nentries; e += run) {
+            for (run = 0; e + run < nentries && entries[e + run].key == entries[e].key; run++) {
+                i = entries[e + run].index;
+                memcpy(records + run * set->recordSize, &pts[i], sizeof(Point));
+                if (attrs)
+                    memcpy(records + run * set->recordSize + sizeof(Point),
+                        attrs + i * layout->attrStride, layout->attrStride);
+            }
+            tilePath(set, entries[e].key / 2, entries[e].key % 2 ? "halo" : "core", path);
+            ok = appendRecords(path, records, run, set->recordSize);
+        }
+        *total += n;
+    }
+    if (n < 0)
+        ok = 0;
+
+    free(pts);
+    free(attrs);
+    free(records);
+    free(entries);
+    return ok;
+}
+
+static void reserveTilePoints(TilePoints *tp, long size, int attrStride)
+{
+    if (size <= tp->capacity)
+        return;
+    tp->capacity = size > 2 * tp->capacity ? size : 2 * tp->capacity;
+    tp->pts = realloc(tp->pts, sizeof(Point) * tp->capacity);
+    if (attrStride)
+        tp->attrs = realloc(tp->attrs, (size_t) attrStride * tp->capacity);
+}
+
+// appends the records of a tile file whose points lie in the box [lo, hi],
+// all of them if lo is NULL
+static int loadRecords(const TileSet *set, const char *path, TilePoints *tp, const float *lo, const float *hi)
+{
+    int attrStride = set->recordSize - sizeof(Point);
+    char *records, *record;
+    FILE *file;
+    Point p;
+    long n, i;
+
+    file = fopen(path, "rb");
+    if (!file)
+        return 1; // tiles without halo have no halo file
+    records = malloc((size_t) set->recordSize * TILE_READ_BLOCK);
+    while ((n = fread(records, set->recordSize, TILE_READ_BLOCK, file)) > 0) {
+        reserveTilePoints(tp, tp->size + n, attrStride);
+        for (i = 0, record = records; i < n; i++, record += set->recordSize) {
+            memcpy(&p, record, sizeof(Point));
+            if (lo && (p.x < lo[0] || p.y < lo[1] || p.z < lo[2] || p.x > hi[0] || p.y > hi[1] || p.z > hi[2]))
+                continue;
+            tp->pts[tp->size] = p;
+            if (attrStride)
+                memcpy(tp->attrs + tp->size * attrStride, record + sizeof(Point), attrStride);
+            tp->size++;
+        }
+    }
+    free(records);
+    fclose(file);
+    return 1;
+}
+
+// appends the core points of another tile that lie in the box [lo, hi]
+static int loadNeighbor(const TileSet *set, const Tile *tile, const Tile *neighbor, const float *lo, const float *hi,
+    TilePoints *tp)
+{
+    char path[4200];
+
+    if (!neighbor || neighbor == tile || !neighbor->ncore)
+        return 1;
+    tilePath(set, neighbor->id, "core", path);
+    return loadRecords(set, path, tp, lo, hi);
+}
+
+// loads the core points of a tile followed by the points of the other tiles
+// within halo of its cube. The halo written while binning is used when it is
+// wide enough, otherwise the core files of the rings of tiles the halo reaches
+// are filtered, or those of all tiles once there are fewer of them
+static int loadTile(const TileSet *set, const Tile *tile, float halo, TilePoints *tp)
+{
+    char path[4200];
+    float lo[3], hi[3];
+    int cell[3], dx, dy, dz, c;
+    long r = (long) ceilf(halo / set->size), t;
+    const Tile *neighbor;
+
+    tp->size = 0;
+    tilePath(set, tile->id, "core", path);
+    if (!loadRecords(set, path, tp, NULL, NULL) || tp->size != tile->ncore)
+        return 0;
+    if (halo <= set->halo) {
+        tilePath(set, tile->id, "halo", path);
+        return loadRecords(set, path, tp, NULL, NULL);
+    }
+    for (c = 0; c < 3; c++) {
+        lo[c] = tile->cell[c] * set->size - halo;
+        hi[c] = (tile->cell[c] + 1) * set->size + halo;
+    }
+    if ((2 * r + 1) * (2 * r + 1) * (2 * r + 1) > set->ntiles) {
+        for (t = 0; t < set->capacity; t++) {
+            neighbor = &set->slots[t];
+            if (neighbor->id < 0 || labs(neighbor->cell[0] - tile->cell[0]) > r ||
+                    labs(neighbor->cell[1] - tile->cell[1]) > r || labs(neighbor->cell[2] - tile->cell[2]) > r)
+                continue;
+            if (!loadNeighbor(set, tile, neighbor, lo, hi, tp))
+                return 0;
+        }
+        return 1;
+    }
+    for (dx = -r; dx <= r; dx++)
+        for (dy = -r; dy <= r; dy++)
+            for (dz = -r; dz <= r; dz++) {
+                cell[0] = tile->cell[0] + dx;
+                cell[1] = tile->cell[1] + dy;
+                cell[2] = tile->cell[2] + dz;
+                if (!loadNeighbor(set, tile, findTile(set, cell), lo, hi, tp))
+                    return 0;
+            }
+    return 1;
+}
+
+// squared distance from p to the nearest face of the loaded region that
+// other points of the cloud may lie behind, FLT_MAX once it holds the whole cloud
+static float sqrMargin(const TileSet *set, const Tile *tile, float halo, Point p)
+{
+    float coords[3] = { p.x, p.y, p.z };
+    float margin = FLT_MAX, lo, hi;
+    int c;
+
+    for (c = 0; c < 3; c++) {
+        lo = tile->cell[c] * set->size - halo;
+        hi = (tile->cell[c] + 1) * set->size + halo;
+        if (lo > set->lo[c] && coords[c] - lo < margin)
+            margin = coords[c] - lo;
+        if (hi < set->hi[c] && hi - coords[c] < margin)
+            margin = hi - coords[c];
+    }
+    return margin == FLT_MAX ? FLT_MAX : margin * margin;
+}
+
+// does the cube of a tile grown by halo hold the bounding box of the cloud?
+static int coversCloud(const TileSet *set, const Tile *tile, float halo)
+{
+    int c;
+
+    for (c = 0; c < 3; c++)
+        if (tile->cell[c] * set->size - halo > set->lo[c] || (tile->cell[c] + 1) * set->size + halo < set->hi[c])
+            return 0;
+    return 1;
+}
+
+// SOR mean distances of the core points of a tile, loaded in tp with the halo
+// written while binning. The halo is doubled while the k nearest neighbors of
+// some points may lie outside of the loaded region, until it holds the whole
+// cloud, so that every mean distance is that of an in-memory run
+static int tileMeanDists(const TileSet *set, const Tile *tile, const FilterParams *params, TilePoints *tp,
+    float *meanDists)
+{
+    Octree octree;
+    char *pending = malloc(tile->ncore > 0 ? tile->ncore : 1);
+    float halo = set->halo;
+    long i, npending = tile->ncore;
+    int last = 0;
+
+    memset(pending, 1, tile->ncore);
+    initOctree(&octree);
+    octree.ownsPoints = 0;
+    while (npending > 0) {
+        if (halo > set->halo && !loadTile(set, tile, halo, tp)) {
+            free(pending);
+            return 0;
+        }
+        last = coversCloud(set, tile, halo);
+        buildOctree(&octree, tp->pts, tp->size, params->bucketSize, params->maxDepth);
+        npending = 0;
+
+        #pragma omp parallel for schedule(dynamic, TILE_CHUNK) reduction(+:npending)
+        for (i = 0; i < tile->ncore; i++) {
+            Point *neighbors = NULL;
+            float *dists = NULL, sum = 0.0f, margin;
+            int j, n = 0;
+
+            if (!pending[i])
+                continue;
+            findKNearest(&octree, tp->pts[i], params->k, FLT_MAX, &neighbors, &n, SOR_FILTER, &dists);
+            margin = sqrMargin(set, tile, halo, tp->pts[i]);
+            for (j = 0; j < n; j++)
+                sum += sqrt(dists[j]);
+            // the only point of a cloud has no neighbor at all
+            meanDists[i] = n ? sum / n : 0.0f;
+            // neighbors outside of the region are farther than the margin
+            pending[i] = !last && (n < params->k || dists[n - 1] >= margin);
+            npending += pending[i];
+            free(neighbors);
+            free(dists);
+        }
+        clearOctree(&octree);
+        halo *= 2;
+    }
+    free(pending);
+    return 1;
+}
+
+// passes over the tiles, each run as a pipeline of a loading thread, the
+// filtering one and a writing thread connected by bounded queues, so that
+// reading and writing of tiles overlap with filtering
+enum { PASS_ROR, PASS_SOR_MEANS, PASS_SOR_SELECT };
+
+// a tile going through the stages of a pass
+typedef struct TileJob {
+    const Tile *tile;
+    TilePoints tp;
+    float *meanDists;
+    PointIndex *inds;
+    long capacity;      // of meanDists and inds
+    long resultSize;
+    int ok;
+} TileJob;
+
+typedef struct TilePipeline {
+    const TileSet *set;
+    Tile **tiles;
+    const FilterParams *params;
+    int pass;
+    float threshold;            // SOR selection threshold
+    double sums[2];             // SOR sums of mean distances and their squares
+    PlyWriter *writer;
+    Queue free, loaded, filtered;
+    TileJob jobs[PIPELINE_DEPTH];
+    int ok;
+} TilePipeline;
+
+static int loadMeanDists(const TileSet *set, const Tile *tile, float *meanDists)
+{
+    char path[4200];
+    FILE *file;
+    int ok;
+
+    tilePath(set, tile->id, "mean", path);
+    file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    ok = fread(meanDists, sizeof(float), tile->ncore, file) == (size_t) tile->ncore;
+    fclose(file);
+    return ok;
+}
+
+static void *loadStage(void *arg)
+{
+    TilePipeline *pl = arg;
+    const TileSet *set = pl->set;
+    TileJob *job;
+    char path[4200];
+    long t;
+    double span;
+
+    for (t = 0; t < set->ntiles; t++) {
+        if (!pl->tiles[t]->ncore)
+            continue;
+        job = popQueue(&pl->free);
+        job->tile = pl->tiles[t];
+        if (job->tile->ncore > job->capacity) {
+            job->capacity = job->tile->ncore;
+            job->meanDists = realloc(job->meanDists, sizeof(float) * job->capacity);
+            job->inds = realloc(job->inds, sizeof(PointIndex) * job->capacity);
+        }
+        span = traceBegin();
+        if (pl->pass == PASS_SOR_SELECT) {
+            job->tp.size = 0;
+            tilePath(set, job->tile->id, "core", path);
+            job->ok = loadRecords(set, path, &job->tp, NULL, NULL) &&
+                loadMeanDists(set, job->tile, job->meanDists);
+        }
+        else
+            job->ok = loadTile(set, job->tile, set->halo, &job->tp);
+        traceEnd("load tile", span);
+        pushQueue(&pl->loaded, job);
+    }
+    closeQueue(&pl->loaded);
+    return NULL;
+}
+
+static void *writeStage(void *arg)
+{
+    TilePipeline *pl = arg;
+    TileJob *job;
+    char path[4200];
+    double span;
+
+    while ((job = popQueue(&pl->filtered))) {
+        span = traceBegin();
+        if (!job->ok)
+            pl->ok = 0;
+        else if (pl->pass == PASS_SOR_MEANS) {
+            tilePath(pl->set, job->tile->id, "mean", path);
+            pl->ok = pl->ok && appendRecords(path, (char *) job->meanDists, job->tile->ncore, sizeof(float));
+        }
+        else
+            pl->ok = pl->ok && writePlyPoints(pl->writer, job->tp.pts, job->tp.attrs, job->inds, job->resultSize);
+        traceEnd("write tile", span);
+        pushQueue(&pl->free, job);
+    }
+    return NULL;
+}
+
+// filtering stage, run by the calling thread so that filters use its OpenMP threads
+static void filterStage(TilePipeline *pl)
+{
+    Octree octree;
+    TileJob *job;
+    long ncore;
+    double span;
+
+    initOctree(&octree);
+    octree.ownsPoints = 0;
+    while ((job = popQueue(&pl->loaded))) {
+        span = traceBegin();
+        ncore = job->tile->ncore;
+        job->resultSize = 0;
+        if (job->ok && pl->pass == PASS_ROR) {
+            buildOctree(&octree, job->tp.pts, job->tp.size, pl->params->bucketSize, pl->params->maxDepth);
+            RORfilterRange(&octree, pl->params->k, pl->params->radius, 0, ncore, job->inds, &job->resultSize);
+            clearOctree(&octree);
+        }
+        else if (job->ok && pl->pass == PASS_SOR_MEANS) {
+            job->ok = tileMeanDists(pl->set, job->tile, pl->params, &job->tp, job->meanDists);
+            if (job->ok)
+                SORaddSums(job->meanDists, NULL, ncore, pl->sums);
+        }
+        else if (job->ok)
+            SORselect(job->meanDists, 0, ncore, pl->threshold, job->inds, &job->resultSize);
+        traceEnd("filter tile", span);
+        pushQueue(&pl->filtered, job);
+    }
+    closeQueue(&pl->filtered);
+}
+
+static int runTilePipeline(TilePipeline *pl)
+{
+    pthread_t loader, writer;
+    int j;
+
+    pl->ok = 1;
+    initQueue(&pl->free, PIPELINE_DEPTH);
+    initQueue(&pl->loaded, PIPELINE_DEPTH);
+    initQueue(&pl->filtered, PIPELINE_DEPTH);
+    for (j = 0; j < PIPELINE_DEPTH; j++)
+        pushQueue(&pl->free, &pl->jobs[j]);
+
+    pthread_create(&loader, NULL, loadStage, pl);
+    pthread_create(&writer, NULL, writeStage, pl);
+    filterStage(pl);
+    pthread_join(loader, NULL);
+    pthread_join(writer, NULL);
+
+    destroyQueue(&pl->free);
+    destroyQueue(&pl->loaded);
+    destroyQueue(&pl->filtered);
+    return pl->ok;
+}
+
+// SOR needs the statistics of all mean distances before selecting any point:
+// mean distances of every tile are stored in its .mean file by a first pass,
+// and tiles are read again and selected by a second one
+static int filterTiles(const TileSet *set, Tile **tiles, const FilterParams *params,
+    PlyWriter *writer, long total)
+{
+    TilePipeline pl;
+    int ok, j;
+
+    memset(&pl, 0, sizeof(TilePipeline));
+    pl.set = set;
+    pl.tiles = tiles;
+    pl.params = params;
+    pl.writer = writer;
+    if (params->filterType == 'R') {
+        pl.pass = PASS_ROR;
+        ok = runTilePipeline(&pl);
+    }
+    else {
+        pl.pass = PASS_SOR_MEANS;
+        ok = runTilePipeline(&pl);
+        pl.threshold = SORsumsThreshold(pl.sums, total, params->radius);
+        pl.pass = PASS_SOR_SELECT;
+        ok = ok && runTilePipeline(&pl);
+    }
+
+    for (j = 0; j < PIPELINE_DEPTH; j++) {
+        free(pl.jobs[j].tp.pts);
+        free(pl.jobs[j].tp.attrs);
+        free(pl.jobs[j].meanDists);
+        free(pl.jobs[j].inds);
+    }
+    return ok;
+}
+
+static int tileIdComp(const void *a, const void *b)
+{
+    const Tile *x = *(Tile * const *) a, *y = *(Tile * const *) b;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+// filters a PLY file tile by tile into output. total and kept are set to
+// the numbers of points read and written. Returns 1 on success
+int filterTiled(const char *input, const char *output, const FilterParams *params, long *total, long *kept)
+{
+    TileSet set;
+    PlyReader reader;
+    PlyWriter writer;
+    Tile **tiles;
+    const char *tmp = getenv("TMPDIR");
+    const char *kinds[] = { "core", "halo", "mean" };
+    char path[4200];
+    long i, t;
+    int ok, c;
+
+    *total = 0;
+    *kept = 0;
+    // ROR neighbors are within the radius, SOR ones are searched in a growing halo
+    if (params->tileSize <= 0 || (params->filterType == 'R' && params->radius >= params->tileSize))
+        return 0;
+    if (!openPlyReader(input, &reader))
+        return 0;
+
+    memset(&set, 0, sizeof(TileSet));
+    set.size = params->tileSize;
+    set.halo = params->filterType == 'R' ? params->radius : SOR_HALO * params->tileSize;
+    set.recordSize = sizeof(Point) + (reader.layout.nattributes ? reader.layout.attrStride : 0);
+    set.capacity = 64;
+    set.slots = malloc(sizeof(Tile) * set.capacity);
+    for (i = 0; i < set.capacity; i++)
+        set.slots[i].id = -1;
+    snprintf(set.dir, sizeof(set.dir), "%s/octree-tiles-XXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(set.dir)) {
+        free(set.slots);
+        closePlyReader(&reader);
+        return 0;
+    }
+
+    ok = binCloud(&set, &reader, params->noiseProb, total);
+    tiles = malloc(sizeof(Tile *) * (set.ntiles > 0 ? set.ntiles : 1));
+    for (i = 0, t = 0; i < set.capacity; i++)
+        if (set.slots[i].id >= 0)
+            tiles[t++] = &set.slots[i];
+    qsort(tiles, set.ntiles, sizeof(Tile *), tileIdComp);
+
+    if (ok)
+        ok = openPlyWriter(output, &writer, params->binary, &reader.layout);
+    if (ok) {
+        ok = filterTiles(&set, tiles, params, &writer, *total);
+        *kept = writer.count;
+        ok = closePlyWriter(&writer) && ok;
+    }
+
+    for (t = 0; t < set.ntiles; t++)
+        for (c = 0; c < 3; c++) {
+            tilePath(&set, tiles[t]->id, kinds[c], path);
+            unlink(path);
+        }
+    rmdir(set.dir);
+    free(tiles);
+    free(set.slots);
+    closePlyReader(&reader);
+    return ok;
+}
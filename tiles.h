@@ -0,0 +1,13 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include "ply_io.h"
+
+// out-of-core filtering of clouds larger than memory. One pass over the input
+// bins the points into cubic tiles stored in temporary files, every tile is then
+// loaded with a halo of points of its neighbors, filtered, and its kept points
+// are appended to the output. Memory depends on the tile size, not on the cloud size
+
+int filterTiled(const char *, const char *, const FilterParams *, long *, long *);
+
+#endif
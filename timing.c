@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+
+#include "timing.h"
+#include "trace.h"
+
+static double clockSeconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double monotonicSeconds()
+{
+    return clockSeconds(CLOCK_MONOTONIC);
+}
+
+// CPU time of every thread of the pool. The pool keeps its threads between
+// parallel regions of the same size, so differences of two samples are the
+// time each thread spent in between
+static void sampleThreads(double *cpu, int nthreads)
+{
+    #pragma omp parallel num_threads(nthreads)
+    cpu[omp_get_thread_num()] = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void initTimings(Timings *timings)
+{
+    memset(timings, 0, sizeof(Timings));
+    timings->nthreads = omp_get_max_threads();
+    timings->ranks = 1;
+    timings->phaseThreadCpu = calloc(timings->nthreads, sizeof(double));
+    timings->start = monotonicSeconds();
+}
+
+void freeTimings(Timings *timings)
+{
+    int p;
+    for (p = 0; p < timings->nphases; p++)
+        free(timings->phases[p].threadCpu);
+    free(timings->phaseThreadCpu);
+    memset(timings, 0, sizeof(Timings));
+}
+
+void beginPhase(Timings *timings, const char *name)
+{
+    if (timings->nphases == TIMING_MAX_PHASES)
+        return;
+    timings->phases[timings->nphases].name = name;
+    sampleThreads(timings->phaseThreadCpu, timings->nthreads);
+    timings->phaseCpu = clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    timings->phaseWall = monotonicSeconds();
+    timings->phaseSpan = traceBegin();
+}
+
+void endPhase(Timings *timings)
+{
+    Phase *phase = &timings->phases[timings->nphases];
+    int t;
+
+    if (timings->nphases == TIMING_MAX_PHASES)
+        return;
+    phase->wall = monotonicSeconds() - timings->phaseWall;
+    traceEnd(phase->name, timings->phaseSpan);
+    phase->cpu = clockSeconds(CLOCK_PROCESS_CPUTIME_ID) - timings->phaseCpu;
+    phase->threadCpu = malloc(sizeof(double) * timings->nthreads);
+    sampleThreads(phase->threadCpu, timings->nthreads);
+    for (t = 0; t < timings->nthreads; t++)
+        phase->threadCpu[t] -= timings->phaseThreadCpu[t];
+    phase->peakRss = peakRss();
+    timings->nphases++;
+}
+
+// wall seconds of the phases of a name, 0 if there is none
+double phaseSeconds(const Timings *timings, const char *name)
+{
+    double seconds = 0.0;
+    int p;
+
+    for (p = 0; p < timings->nphases; p++)
+        if (!strcmp(timings->phases[p].name, name))
+            seconds += timings->phases[p].wall;
+    return seconds;
+}
+
+void printTimings(const Timings *timings)
+{
+    int p;
+
+    printf("\n%-10s %12s %12s %14s\n", "phase", "wall, s", "cpu, s", "peak RSS, MB");
+    for (p = 0; p < timings->nphases; p++)
+        printf("%-10s %12.6f %12.6f %14.2f\n", timings->phases[p].name, timings->phases[p].wall,
+            timings->phases[p].cpu, timings->phases[p].peakRss / 1048576.0);
+    printf("%-10s %12.6f\n", "total", monotonicSeconds() - timings->start);
+}
+
+static void writeString(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(file, "\\u%04x", *s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+// writes the timings and the description of the run as a JSON object.
+// Returns 1 on success
+int writeTimingReport(const char *path, const Timings *timings, const RunInfo *info)
+{
+    FILE *file = fopen(path, "w");
+    const FilterParams *params = info->params;
+    int p, t;
+
+    if (!file)
+        return 0;
+    fprintf(file, "{\n  \"input\": ");
+    writeString(file, info->input);
+    fprintf(file, ",\n  \"mode\": \"%s\",\n", info->mode);
+    fprintf(file, "  \"filter\": \"%s\",\n", params->filterType == 'R' ? "ror" : "sor");
+    fprintf(file, "  \"k\": %d,\n", params->k);
+    fprintf(file, "  \"%s\": %g,\n", params->filterType == 'R' ? "radius" : "multiplier", params->radius);
+    fprintf(file, "  \"noise\": %g,\n", params->noiseProb);
+    fprintf(file, "  \"tile_size\": %g,\n", params->tileSize);
+    fprintf(file, "  \"points\": %ld,\n", info->points);
+    fprintf(file, "  \"kept\": %ld,\n", info->kept);
+    fprintf(file, "  \"ranks\": %d,\n", timings->ranks);
+    fprintf(file, "  \"threads\": %d,\n", timings->nthreads);
+    fprintf(file, "  \"wall_seconds\": %.6f,\n", monotonicSeconds() - timings->start);
+    fprintf(file, "  \"peak_rss_bytes\": %ld,\n", peakRss());
+    if (info->memory) {
+        const MemoryUsage *m = info->memory;
+        fprintf(file, "  \"memory_bytes\": { \"points\": %ld, \"attributes\": %ld, \"successors\": %ld, "
+            "\"octants\": %ld, \"workspaces\": %ld, \"results\": %ld, \"output\": %ld, \"dedup\": %ld, "
+            "\"total\": %ld },\n",
+            m->points, m->attributes, m->successors, m->octants, m->workspaces, m->results, m->output,
+            m->dedup, m->total);
+    }
+    fprintf(file, "  \"phases\": [");
+    for (p = 0; p < timings->nphases; p++) {
+        const Phase *phase = &timings->phases[p];
+        fprintf(file, "%s\n    { \"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+            "\"peak_rss_bytes\": %ld, \"thread_cpu_seconds\": [", p ? "," : "", phase->name, phase->wall,
+            phase->cpu, phase->peakRss);
+        for (t = 0; t < timings->nthreads; t++)
+            fprintf(file, "%s%.6f", t ? ", " : "", phase->threadCpu[t]);
+        fprintf(file, "] }");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return !fclose(file);
+}
@@ -0,0 +1,54 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "my_octree.h"
+#include "memory.h"
+
+// wall and CPU time of the phases of a run on the monotonic clock. The CPU time
+// of every thread of the OpenMP pool is sampled when a phase begins and ends,
+// the process CPU time also counts other threads (tile loading and writing)
+
+#define TIMING_MAX_PHASES 16
+
+typedef struct Phase {
+    const char *name;
+    double wall;        // seconds
+    double cpu;         // CPU seconds of the process
+    double *threadCpu;  // CPU seconds of every OpenMP thread
+    long peakRss;       // bytes of the process at the end of the phase
+} Phase;
+
+typedef struct Timings {
+    Phase phases[TIMING_MAX_PHASES];
+    int nphases;
+    int nthreads;
+    int ranks;          // processes whose phases were reduced into these
+    double start;       // of the run
+    double phaseWall;   // of the open phase
+    double phaseCpu;
+    double *phaseThreadCpu;
+    double phaseSpan;   // trace start of the open phase
+} Timings;
+
+// what a report says about the run besides its timings
+typedef struct RunInfo {
+    const char *input;
+    const char *mode;   // serial, mpi, tiled or batch
+    const FilterParams *params;
+    long points;
+    long kept;
+    const MemoryUsage *memory;  // buffers of the run, NULL if not measured
+} RunInfo;
+
+double monotonicSeconds();
+
+void initTimings(Timings *);
+void freeTimings(Timings *);
+void beginPhase(Timings *, const char *);
+void endPhase(Timings *);
+double phaseSeconds(const Timings *, const char *);
+
+void printTimings(const Timings *);
+int writeTimingReport(const char *, const Timings *, const RunInfo *);
+
+#endif
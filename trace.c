@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define TRACE_MAX_THREADS 256 // threads past it aren't traced
+#define TRACE_INITIAL_EVENTS 1024
+
+typedef struct TraceBuffer {
+    TraceEvent *events;
+    long size;
+    long capacity;
+} TraceBuffer;
+
+int tracing = 0;
+static int traceRank;
+static double traceStart;
+static TraceBuffer buffers[TRACE_MAX_THREADS];
+static int nbuffers;
+static pthread_mutex_t buffersLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int threadBuffer = -1; // track of the thread, -1 before its first span
+
+static double nowMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// buffer of the calling thread, NULL past TRACE_MAX_THREADS
+static TraceBuffer *threadTrace()
+{
+    if (threadBuffer < 0) {
+        pthread_mutex_lock(&buffersLock);
+        threadBuffer = nbuffers < TRACE_MAX_THREADS ? nbuffers++ : TRACE_MAX_THREADS;
+        pthread_mutex_unlock(&buffersLock);
+    }
+    return threadBuffer < TRACE_MAX_THREADS ? &buffers[threadBuffer] : NULL;
+}
+
+// starts recording spans of the process of a rank, the calling thread gets the first track
+void enableTrace(int rank)
+{
+    traceRank = rank;
+    traceStart = nowMicros();
+    tracing = 1;
+    threadTrace();
+}
+
+// start of a span, passed to traceEnd once the work is done
+double traceBegin()
+{
+    return tracing ? nowMicros() - traceStart : 0.0;
+}
+
+void traceEnd(const char *name, double begin)
+{
+    TraceBuffer *buffer;
+    TraceEvent *event;
+
+    if (!tracing || !(buffer = threadTrace()))
+        return;
+    if (buffer->size == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? 2 * buffer->capacity : TRACE_INITIAL_EVENTS;
+        buffer->events = realloc(buffer->events, sizeof(TraceEvent) * buffer->capacity);
+    }
+    event = &buffer->events[buffer->size++];
+    event->name = name;
+    event->begin = begin;
+    event->end = nowMicros() - traceStart;
+}
+
+// spans of all threads of the process as JSON events, each one preceded by a
+// comma, after the names of the process and of its threads. Called when no
+// thread records spans any more, the text is freed by the caller
+char *formatTrace(long *length)
+{
+    char *text;
+    size_t size;
+    FILE *stream = open_memstream(&text, &size);
+    const TraceEvent *event;
+    long e;
+    int t;
+
+    fprintf(stream, ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+        traceRank, traceRank);
+    for (t = 0; t < nbuffers; t++) {
+        fprintf(stream, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+            "\"args\": {\"name\": \"%s %d\"}}", traceRank, t, t ? "thread" : "main", t);
+        for (e = 0; e < buffers[t].size; e++) {
+            event = &buffers[t].events[e];
+            fprintf(stream, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, "
+                "\"dur\": %.3f}", event->name, traceRank, t, event->begin, event->end - event->begin);
+        }
+    }
+    fclose(stream);
+    *length = size;
+    return text;
+}
+
+// writes events of formatTrace, of one or more processes, into a trace file.
+// Returns 1 on success
+int writeTrace(const char *path, const char *events, long length)
+{
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+        return 0;
+    // the first event's leading comma is dropped
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    if (length > 0)
+        fwrite(events + 1, 1, length - 1, file);
+    fprintf(file, "\n]}\n");
+    return !fclose(file);
+}
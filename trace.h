@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// spans of work of every thread written as a Chrome trace (open it in
+// chrome://tracing or Perfetto), one track per thread, one process per rank.
+// Threads append spans to their own buffers, only the first span of a thread
+// takes a lock. When tracing isn't enabled spans cost a branch
+
+typedef struct TraceEvent {
+    const char *name;   // static string
+    double begin;       // microseconds since tracing was enabled
+    double end;
+} TraceEvent;
+
+extern int tracing;
+
+void enableTrace(int);
+double traceBegin();
+void traceEnd(const char *, double);
+
+char *formatTrace(long *);
+int writeTrace(const char *, const char *, long);
+
+#endif
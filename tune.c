@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "tune.h"
+#include "timing.h"
+#include "alloc.h"
+
+#define TUNE_BOX_ROUNDS 16 // resizings of the sampled box
+
+static const int tuneBuckets[] = { 8, 16, 32, 64, 128 };
+
+// points in the cube of half edge h around center, at most limit of them
+// are copied into sample if it isn't NULL, with their weights if there are any
+static long pointsInBox(const Point *pts, const PointIndex *weights, PointIndex n, Point center, float h,
+    Point *sample, PointIndex *sampleWeights, long limit)
+{
+    long count = 0;
+    PointIndex i;
+
+    for (i = 0; i < n; i++) {
+        if (fabsf(pts[i].x - center.x) > h || fabsf(pts[i].y - center.y) > h || fabsf(pts[i].z - center.z) > h)
+            continue;
+        if (sample && count < limit) {
+            sample[count] = pts[i];
+            if (weights)
+                sampleWeights[count] = weights[i];
+        }
+        count++;
+    }
+    return count;
+}
+
+// about TUNE_SAMPLE points of a box around the middle point of the array. A
+// region of the cloud keeps its spacing, so radius queries find as many
+// neighbors as in the whole cloud, unlike in a random subset of its points.
+// Weights of the points of a deduplicated cloud are sampled with them
+static Point *sampleCloud(const Point *pts, const PointIndex *weights, PointIndex n, PointIndex **sampleWeights,
+    long *size)
+{
+    Point *sample;
+    Point center = pts[n / 2], lo = pts[0], hi = pts[0];
+    float h, extent;
+    double factor;
+    long count = n;
+    PointIndex i;
+    int round;
+
+    *sampleWeights = NULL;
+    if (n <= 2 * TUNE_SAMPLE) {
+        sample = malloc(sizeof(Point) * n);
+        memcpy(sample, pts, sizeof(Point) * n);
+        if (weights) {
+            *sampleWeights = malloc(sizeof(PointIndex) * n);
+            memcpy(*sampleWeights, weights, sizeof(PointIndex) * n);
+        }
+        *size = n;
+        return sample;
+    }
+
+    for (i = 0; i < n; i++) {
+        lo.x = fminf(lo.x, pts[i].x);
+        lo.y = fminf(lo.y, pts[i].y);
+        lo.z = fminf(lo.z, pts[i].z);
+        hi.x = fmaxf(hi.x, pts[i].x);
+        hi.y = fmaxf(hi.y, pts[i].y);
+        hi.z = fmaxf(hi.z, pts[i].z);
+    }
+    extent = fmaxf(hi.x - lo.x, fmaxf(hi.y - lo.y, hi.z - lo.z));
+    h = 0.5f * extent * cbrt((double) TUNE_SAMPLE / n);
+
+    // the box is scaled by the cube root of the missing share of points
+    for (round = 0; round < TUNE_BOX_ROUNDS; round++) {
+        count = pointsInBox(pts, NULL, n, center, h, NULL, NULL, 0);
+        if (count >= TUNE_SAMPLE / 2 && count <= 2 * TUNE_SAMPLE)
+            break;
+        factor = cbrt((double) TUNE_SAMPLE / (count > 0 ? count : 1));
+        h *= factor < 0.5 ? 0.5 : factor > 2.0 ? 2.0 : factor;
+    }
+    // clouds of duplicates may not shrink to the sample size
+    if (count > 2 * TUNE_SAMPLE)
+        count = 2 * TUNE_SAMPLE;
+    sample = malloc(sizeof(Point) * (count > 0 ? count : 1));
+    if (weights)
+        *sampleWeights = malloc(sizeof(PointIndex) * (count > 0 ? count : 1));
+    pointsInBox(pts, weights, n, center, h, sample, *sampleWeights, count);
+    *size = count;
+    return sample;
+}
+
+// estimated seconds of the build and of the queries of a filter on n points
+// with a bucket size, from the fastest of TUNE_REPS timings on the sample. The
+// queries of weighted points leave out their own copies, like those of the filters
+static double estimateRun(Point *sample, const PointIndex *weights, long size, PointIndex n, const FilterParams *params,
+    int bucketSize)
+{
+    Octree octree;
+    Point *neighbors;
+    float *dists;
+    double start, build = DBL_MAX, queries = DBL_MAX;
+    long nqueries = n / TUNE_SHARE, q, s, need;
+    int rep, found;
+
+    // all candidates together time a small share of the queries of a small cloud
+    if (nqueries > TUNE_QUERIES)
+        nqueries = TUNE_QUERIES;
+    if (nqueries < TUNE_MIN_QUERIES)
+        nqueries = TUNE_MIN_QUERIES;
+    if (nqueries > size)
+        nqueries = size;
+
+    initOctree(&octree);
+    octree.ownsPoints = 0;
+    octree.weights = weights;
+    countAlloc(ALLOC_WORKSPACES, (long) params->k * (sizeof(Point) + sizeof(float)));
+    for (rep = 0; rep < TUNE_REPS; rep++) {
+        start = monotonicSeconds();
+        buildOctree(&octree, sample, size, bucketSize, params->maxDepth);
+        build = fmin(build, monotonicSeconds() - start);
+
+        start = monotonicSeconds();
+        for (q = 0; q < nqueries; q++) {
+            s = q * (size / nqueries);
+            need = params->k - (weights ? weights[s] - 1 : 0);
+            if (need <= 0)
+                continue;
+            found = 0;
+            if (params->filterType == 'R')
+                findKNearest(&octree, sample[s], need, params->radius, &neighbors, &found, ROR_FILTER, &dists);
+            else
+                findKNearest(&octree, sample[s], need, FLT_MAX, &neighbors, &found, SOR_FILTER, &dists);
+            free(neighbors);
+            free(dists);
+        }
+        queries = fmin(queries, monotonicSeconds() - start);
+    }
+    countFree(ALLOC_WORKSPACES, (long) params->k * (sizeof(Point) + sizeof(float)));
+    clearOctree(&octree);
+    return build * n / size + queries * n / nqueries;
+}
+
+// the bucket size of the fastest estimated run of the filter on n points,
+// weighted by their copies in a deduplicated cloud or NULL
+int tuneBucketSize(Point *pts, const PointIndex *weights, PointIndex n, const FilterParams *params)
+{
+    long size;
+    PointIndex *sampleWeights;
+    Point *sample = sampleCloud(pts, weights, n, &sampleWeights, &size);
+    double seconds, best = DBL_MAX;
+    int bucketSize = BUCKET_SIZE, c;
+
+    countAlloc(ALLOC_POINTS, (long) sizeof(Point) * size);
+    if (sampleWeights)
+        countAlloc(ALLOC_DEDUP, (long) sizeof(PointIndex) * size);
+    if (size >= 2) {
+        printf("Tuning the bucket size on %ld points\n", size);
+        for (c = 0; c < (int) (sizeof(tuneBuckets) / sizeof(int)); c++) {
+            seconds = estimateRun(sample, sampleWeights, size, n, params, tuneBuckets[c]);
+            printf("  bucket size %4d: %f seconds of one thread estimated\n", tuneBuckets[c], seconds);
+            if (seconds < best) {
+                best = seconds;
+                bucketSize = tuneBuckets[c];
+            }
+        }
+    }
+    countFree(ALLOC_POINTS, (long) sizeof(Point) * size);
+    if (sampleWeights)
+        countFree(ALLOC_DEDUP, (long) sizeof(PointIndex) * size);
+    free(sample);
+    free(sampleWeights);
+    return bucketSize;
+}
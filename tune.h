@@ -0,0 +1,18 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "my_octree.h"
+
+// choice of the bucket size of the octree before a run: trees with every
+// candidate size are built on a sample of the cloud and a sample of the queries
+// of the filter is timed on each of them, the fastest size is kept
+
+#define TUNE_SAMPLE 50000   // points the candidate trees are built on
+#define TUNE_QUERIES 2000   // max filter queries timed per candidate
+#define TUNE_MIN_QUERIES 100
+#define TUNE_SHARE 64       // queries timed per candidate are at most 1/64 of those of the run
+#define TUNE_REPS 3         // timings of every candidate, the fastest one counts
+
+int tuneBucketSize(Point *, const PointIndex *, PointIndex, const FilterParams *);
+
+#endif